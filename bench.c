@@ -0,0 +1,554 @@
+#include "fox.h"
+#include <stdio.h>
+
+#define BENCH_ITEMS 4096
+#define BENCH_PATH "fox.h" // Relative to the repository root, FOX_BENCH_SOURCE overrides it
+#define BENCH_MAP_KEYS 512
+
+typedef struct {
+    i64 *items;
+    size_t size;
+    size_t capacity;
+} Numbers;
+
+typedef struct {
+    FoxStringView key;
+    size_t value;
+} PathEntry;
+
+typedef struct {
+    PathEntry *items;
+    u32 *hashes;
+    size_t size;
+    size_t capacity;
+} PathMap;
+
+typedef struct {
+    PathEntry *items;
+    size_t size;
+    size_t capacity;
+} PathList;
+
+typedef struct {
+    PathEntry entry;
+    size_t next;
+} ChainNode;
+
+// Separate chaining: buckets hold the index of the first node + 1, 0 for an empty bucket
+typedef struct {
+    ChainNode *items;
+    size_t size;
+    size_t capacity;
+    size_t *buckets;
+    size_t bucket_count;
+} ChainMap;
+
+static const char *source_path = BENCH_PATH;
+static FoxStringBuf source = {0};
+static FoxStringViews source_lines = {0};
+
+// String
+
+static void bench_sb_appendf(FoxBench *bench) {
+    FoxStringBuf sb = {0};
+    for (size_t i = 0; i < bench->iterations; i++) {
+        fox_da_clear(&sb);
+        fox_sb_appendf(&sb, "[%s] %s:%d: compiled %zu files in %.3f ms", "INFO", "src/main.c", 42, i, 12.5);
+        fox_do_not_optimize(sb.items);
+    }
+    bench->bytes = sb.size;
+    fox_sb_free(&sb);
+}
+
+static void bench_ssb_short(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxSmallStringBuf ssb = fox_ssb("build/obj");
+        fox_ssb_concat(&ssb, "/main.o");
+        fox_do_not_optimize(&ssb);
+        fox_ssb_free(&ssb);
+    }
+}
+
+static void bench_str_split(FoxBench *bench) {
+    FoxStringView text = fox_sv(source);
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxStringViews lines = fox_str_split(text, '\n');
+        fox_do_not_optimize(lines.items);
+        fox_da_free(&lines);
+    }
+    bench->bytes = text.size;
+}
+
+static void bench_str_trim(FoxBench *bench) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < bench->iterations; i++) {
+        fox_da_foreach(FoxStringView, line, &source_lines) {
+            FoxStringView trimmed = fox_str_trim(*line);
+            fox_do_not_optimize(&trimmed);
+        }
+    }
+    fox_da_foreach(FoxStringView, line, &source_lines) { bytes += line->size; }
+    bench->bytes = bytes;
+}
+
+// Arguments of a typical compiler invocation, built one by one
+#define BENCH_CMD_ARGS 8
+
+static void bench_cmd_build_sb(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxStringBufs args = {0};
+        FoxCmd cmd = {0};
+        for (size_t n = 0; n < BENCH_CMD_ARGS; n++) {
+            FoxStringBuf arg = {0};
+            fox_sb_appendf(&arg, n % 2 == 0 ? "-Iinclude/%zu" : "src/m%zu.c", n);
+            fox_da_append(&args, arg);
+        }
+        fox_da_foreach(FoxStringBuf, arg, &args) { fox_cmd_append(&cmd, arg->items); }
+        fox_do_not_optimize(cmd.items);
+        fox_cmd_free(&cmd);
+        fox_str_bufs_free(&args);
+    }
+}
+
+static void bench_cmd_build_ssb(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxSmallArray(FoxSmallStringBuf, BENCH_CMD_ARGS) args;
+        fox_da_small_init(&args);
+        FoxSmallArray(const char *, BENCH_CMD_ARGS) cmd;
+        fox_da_small_init(&cmd);
+        for (size_t n = 0; n < BENCH_CMD_ARGS; n++) {
+            FoxSmallStringBuf arg = {0};
+            fox_ssb_appendf(&arg, n % 2 == 0 ? "-Iinclude/%zu" : "src/m%zu.c", n);
+            fox_da_append(&args, arg);
+        }
+        fox_da_foreach(FoxSmallStringBuf, arg, &args) { fox_da_append(&cmd, fox_ssb_data(arg)); }
+        fox_do_not_optimize(cmd.items);
+        fox_da_free(&cmd);
+        fox_small_str_bufs_free(&args);
+    }
+}
+
+static void bench_intern(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxInterner interner = {0};
+        fox_da_foreach(FoxStringView, line, &source_lines) {
+            FoxStringView interned = fox_intern_sv(&interner, *line);
+            fox_do_not_optimize(&interned);
+        }
+        fox_interner_free(&interner);
+    }
+}
+
+// Hashing
+
+static void bench_hash_short(FoxBench *bench) {
+    u64 hash = 0;
+    for (size_t i = 0; i < bench->iterations; i++) {
+        fox_da_foreach(FoxStringView, line, &source_lines) { hash ^= fox_hash_bytes(line->items, line->size, 0); }
+    }
+    fox_do_not_optimize(&hash);
+    bench->bytes = source.size;
+}
+
+static void bench_hash_bulk(FoxBench *bench) {
+    u64 hash = 0;
+    for (size_t i = 0; i < bench->iterations; i++)
+        hash ^= fox_hash_bytes(source.items, source.size, i);
+    fox_do_not_optimize(&hash);
+    bench->bytes = source.size;
+}
+
+static void bench_hash128_bulk(FoxBench *bench) {
+    u64 hash = 0;
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxHash128 h = fox_hash128_bytes(source.items, source.size, i);
+        hash ^= h.low ^ h.high;
+    }
+    fox_do_not_optimize(&hash);
+    bench->bytes = source.size;
+}
+
+static void bench_hasher_bulk(FoxBench *bench) {
+    u64 hash = 0;
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxHasher hasher;
+        fox_hasher_init(&hasher, i);
+        fox_hasher_update(&hasher, source.items, source.size);
+        hash ^= fox_hasher_digest(&hasher);
+    }
+    fox_do_not_optimize(&hash);
+    bench->bytes = source.size;
+}
+
+static void bench_fs_hash_file(FoxBench *bench) {
+    u64 hash = 0;
+    for (size_t i = 0; i < bench->iterations; i++)
+        FOX_ASSERT(fox_fs_hash_file(source_path, &hash), "could not hash the source file");
+    fox_do_not_optimize(&hash);
+    bench->bytes = source.size;
+}
+
+// Dynamic arrays and maps
+
+static void bench_da_append(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        Numbers numbers = {0};
+        for (i64 n = 0; n < BENCH_ITEMS; n++)
+            fox_da_append(&numbers, n);
+        fox_do_not_optimize(numbers.items);
+        fox_da_free(&numbers);
+    }
+    bench->bytes = BENCH_ITEMS * sizeof(i64);
+}
+
+static void bench_da_small_append(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxSmallArray(i64, 16) numbers;
+        fox_da_small_init(&numbers);
+        for (i64 n = 0; n < 16; n++)
+            fox_da_append(&numbers, n);
+        fox_do_not_optimize(numbers.items);
+        fox_da_free(&numbers);
+    }
+}
+
+static void bench_arena_append(FoxBench *bench) {
+    FoxArena arena = {0};
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxArena *prev = fox_arena_scope_begin(&arena);
+        Numbers numbers = {0};
+        for (i64 n = 0; n < BENCH_ITEMS; n++)
+            fox_da_append(&numbers, n);
+        fox_do_not_optimize(numbers.items);
+        fox_arena_scope_end(prev);
+        fox_arena_reset(&arena);
+    }
+    fox_arena_free(&arena);
+    bench->bytes = BENCH_ITEMS * sizeof(i64);
+}
+
+static void bench_hm_put_get(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        PathMap map = {0};
+        size_t n = 0;
+        fox_da_foreach(FoxStringView, line, &source_lines) { fox_hm_put(&map, *line, n++); }
+        fox_da_foreach(FoxStringView, line, &source_lines) {
+            PathEntry *entry = fox_hm_get(&map, *line);
+            fox_do_not_optimize(entry);
+        }
+        fox_hm_free(&map);
+    }
+}
+
+static size_t map_keys_count(void) { return source_lines.size < BENCH_MAP_KEYS ? source_lines.size : BENCH_MAP_KEYS; }
+
+static void bench_hm_put_get_small(FoxBench *bench) {
+    const size_t count = map_keys_count();
+    for (size_t i = 0; i < bench->iterations; i++) {
+        PathMap map = {0};
+        for (size_t j = 0; j < count; j++)
+            fox_hm_put(&map, source_lines.items[j], j);
+        for (size_t j = 0; j < count; j++) {
+            PathEntry *entry = fox_hm_get(&map, source_lines.items[j]);
+            fox_do_not_optimize(entry);
+        }
+        fox_hm_free(&map);
+    }
+}
+
+static PathEntry *path_list_get(PathList *list, FoxStringView key) {
+    fox_da_foreach(PathEntry, entry, list) {
+        if (fox_str_equals(entry->key, key))
+            return entry;
+    }
+    return NULL;
+}
+
+static void bench_linear_put_get(FoxBench *bench) {
+    const size_t count = map_keys_count();
+    for (size_t i = 0; i < bench->iterations; i++) {
+        PathList list = {0};
+        for (size_t j = 0; j < count; j++) {
+            PathEntry *entry = path_list_get(&list, source_lines.items[j]);
+            if (entry != NULL)
+                entry->value = j;
+            else
+                fox_da_append(&list, ((PathEntry){.key = source_lines.items[j], .value = j}));
+        }
+        for (size_t j = 0; j < count; j++) {
+            PathEntry *entry = path_list_get(&list, source_lines.items[j]);
+            fox_do_not_optimize(entry);
+        }
+        fox_da_free(&list);
+    }
+}
+
+static size_t chain_map_bucket(const ChainMap *map, FoxStringView key) {
+    return (size_t) fox_hash_bytes(key.items, key.size, 0) & (map->bucket_count - 1);
+}
+
+static PathEntry *chain_map_get(ChainMap *map, FoxStringView key) {
+    if (map->bucket_count == 0)
+        return NULL;
+    for (size_t node = map->buckets[chain_map_bucket(map, key)]; node != 0; node = map->items[node - 1].next) {
+        if (fox_str_equals(map->items[node - 1].entry.key, key))
+            return &map->items[node - 1].entry;
+    }
+    return NULL;
+}
+
+static void chain_map_put(ChainMap *map, FoxStringView key, size_t value) {
+    PathEntry *existing = chain_map_get(map, key);
+    if (existing != NULL) {
+        existing->value = value;
+        return;
+    }
+    if (map->size >= map->bucket_count) {
+        // Rebuild the chains at twice the bucket count, keeping the load factor at most 1
+        free(map->buckets);
+        map->bucket_count = map->bucket_count == 0 ? 16 : map->bucket_count * 2;
+        map->buckets = calloc(map->bucket_count, sizeof(*map->buckets));
+        for (size_t i = 0; i < map->size; i++) {
+            size_t bucket = chain_map_bucket(map, map->items[i].entry.key);
+            map->items[i].next = map->buckets[bucket];
+            map->buckets[bucket] = i + 1;
+        }
+    }
+    size_t bucket = chain_map_bucket(map, key);
+    fox_da_append(map, ((ChainNode){.entry = {.key = key, .value = value}, .next = map->buckets[bucket]}));
+    map->buckets[bucket] = map->size;
+}
+
+static void bench_chained_put_get(FoxBench *bench) {
+    const size_t count = map_keys_count();
+    for (size_t i = 0; i < bench->iterations; i++) {
+        ChainMap map = {0};
+        for (size_t j = 0; j < count; j++)
+            chain_map_put(&map, source_lines.items[j], j);
+        for (size_t j = 0; j < count; j++) {
+            PathEntry *entry = chain_map_get(&map, source_lines.items[j]);
+            fox_do_not_optimize(entry);
+        }
+        free(map.buckets);
+        fox_da_free(&map);
+    }
+}
+
+static void sum_fold(void *user, const void *item, size_t index, void *partial) {
+    (void) user, (void) index;
+    *(i64 *) partial += *(const i64 *) item;
+}
+
+static void sum_combine(void *user, void *acc, const void *partial) {
+    (void) user;
+    *(i64 *) acc += *(const i64 *) partial;
+}
+
+static void bench_da_parallel_reduce(FoxBench *bench) {
+    Numbers numbers = {0};
+    for (i64 n = 0; n < 1024 * 1024; n++)
+        fox_da_append(&numbers, n);
+    for (size_t i = 0; i < bench->iterations; i++) {
+        i64 sum = 0;
+        fox_da_parallel_reduce(&numbers, sum_fold, sum_combine, NULL, &sum);
+        fox_do_not_optimize(&sum);
+    }
+    bench->bytes = numbers.size * sizeof(i64);
+    fox_da_free(&numbers);
+}
+
+// Concurrent queues
+
+#define BENCH_QUEUE_THREADS 4
+
+static int mpmc_producer(void *arg) {
+    FoxBench *bench = arg;
+    FoxMpmcQueue *queue = bench->user;
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_mpmc_push(queue, &i);
+    return 0;
+}
+
+static int mpmc_consumer(void *arg) {
+    FoxBench *bench = arg;
+    FoxMpmcQueue *queue = bench->user;
+    size_t item;
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_mpmc_pop(queue, &item);
+    return 0;
+}
+
+static void bench_mpmc_contention(FoxBench *bench) {
+    FoxMpmcQueue queue;
+    FOX_ASSERT(fox_mpmc_init(&queue, size_t, 1024), "could not create the queue");
+    FoxBench per_thread = {.iterations = bench->iterations / BENCH_QUEUE_THREADS + 1, .user = &queue};
+    thrd_t threads[2 * BENCH_QUEUE_THREADS];
+    for (size_t i = 0; i < BENCH_QUEUE_THREADS; i++) {
+        thrd_create(&threads[i], mpmc_producer, &per_thread);
+        thrd_create(&threads[BENCH_QUEUE_THREADS + i], mpmc_consumer, &per_thread);
+    }
+    for (size_t i = 0; i < 2 * BENCH_QUEUE_THREADS; i++)
+        thrd_join(threads[i], NULL);
+    fox_mpmc_free(&queue);
+}
+
+static int spsc_producer(void *arg) {
+    FoxBench *bench = arg;
+    FoxSpscRing *ring = bench->user;
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_spsc_push(ring, &i);
+    return 0;
+}
+
+static void bench_spsc_transfer(FoxBench *bench) {
+    FoxSpscRing ring;
+    FOX_ASSERT(fox_spsc_init(&ring, size_t, 1024), "could not create the ring");
+    FoxBench producer = {.iterations = bench->iterations, .user = &ring};
+    thrd_t thread;
+    thrd_create(&thread, spsc_producer, &producer);
+    size_t item;
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_spsc_pop(&ring, &item);
+    thrd_join(thread, NULL);
+    fox_spsc_free(&ring);
+}
+
+// Logging
+
+static void null_sink_write(FoxSink *sink, FoxStringView sv) {
+    (void) sink;
+    fox_do_not_optimize(sv.items);
+}
+
+static void bench_log_pattern(FoxBench *bench) {
+    FoxLogger logger = {0};
+    fox_da_append(&logger.sinks, ((FoxSink) {.log_handler = fox_default_log_handler, .sink_write = null_sink_write}));
+    fox_logger_pattern(&logger, "%Y-%m-%d %H:%M:%S.%e [%l] %s:%# %v", false);
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_logger_log(&logger, LOG_INFO, "compiled %s in %zu ms", "src/main.c", i);
+    fox_logger_free(&logger);
+}
+
+typedef struct {
+    FoxLogger *logger;
+    size_t lines;
+} LogWorker;
+
+static int log_worker(void *arg) {
+    LogWorker *worker = arg;
+    for (size_t i = 0; i < worker->lines; i++)
+        fox_logger_log(worker->logger, LOG_INFO, "compiled %s in %zu ms", "src/main.c", i);
+    return 0;
+}
+
+// One iteration is one line, spread over the number of threads in bench->user
+static void bench_log_threads(FoxBench *bench) {
+    size_t thread_count = (size_t) (uintptr_t) bench->user;
+    FoxLogger logger = {0};
+    fox_da_append(&logger.sinks, ((FoxSink) {.log_handler = fox_default_log_handler, .sink_write = null_sink_write}));
+    fox_logger_pattern(&logger, "%Y-%m-%d %H:%M:%S.%e [%l] %v", false);
+    LogWorker worker = {.logger = &logger, .lines = (bench->iterations + thread_count - 1) / thread_count};
+    thrd_t threads[32];
+    for (size_t i = 0; i < thread_count; i++)
+        thrd_create(&threads[i], log_worker, &worker);
+    for (size_t i = 0; i < thread_count; i++)
+        thrd_join(threads[i], NULL);
+    fox_logger_free(&logger);
+}
+
+static void bench_log_disabled(FoxBench *bench) {
+    FoxLogger logger = {0};
+    fox_da_append(&logger.sinks, ((FoxSink) {.log_handler = fox_default_log_handler, .sink_write = null_sink_write}));
+    fox_logger_min_level(&logger, LOG_ERROR);
+    for (size_t i = 0; i < bench->iterations; i++)
+        fox_logger_log(&logger, LOG_DEBUG, "compiled %s in %zu ms", "src/main.c", i);
+    fox_logger_free(&logger);
+}
+
+// Filesystem and processes
+
+static void bench_fs_read_entire_file(FoxBench *bench) {
+    FoxStringBuf sb = {0};
+    for (size_t i = 0; i < bench->iterations; i++) {
+        fox_da_clear(&sb);
+        FOX_ASSERT(fox_fs_read_entire_file(source_path, &sb), "could not read the source file");
+    }
+    bench->bytes = sb.size;
+    fox_sb_free(&sb);
+}
+
+static void bench_fs_read_entire_dir(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxStringBufs files = {0};
+        fox_fs_read_entire_dir(".", &files);
+        fox_do_not_optimize(files.items);
+        fox_str_bufs_free(&files);
+    }
+}
+
+static void bench_fs_read_entire_dir_ssb(FoxBench *bench) {
+    for (size_t i = 0; i < bench->iterations; i++) {
+        FoxSmallStringBufs files = {0};
+        fox_fs_read_entire_dir_ssb(".", &files);
+        fox_do_not_optimize(files.items);
+        fox_small_str_bufs_free(&files);
+    }
+}
+
+static void bench_cmd_run(FoxBench *bench) {
+    fox_logger_min_level(&fox_default_logger, LOG_WARNING);
+    FoxCmd cmd = {0};
+    for (size_t i = 0; i < bench->iterations; i++) {
+        fox_cmd_append(&cmd, "/bin/true");
+        fox_cmd_run(&cmd);
+    }
+    fox_cmd_free(&cmd);
+    fox_logger_min_level(&fox_default_logger, LOG_TRACE);
+}
+
+int main(int argc, char *argv[]) {
+    if (getenv("FOX_BENCH_SOURCE") != NULL)
+        source_path = getenv("FOX_BENCH_SOURCE");
+    if (!fox_fs_read_entire_file(source_path, &source)) {
+        fox_log_error("could not read %s, run the benchmarks from the repository root or set FOX_BENCH_SOURCE", source_path);
+        return 1;
+    }
+    source_lines = fox_str_split(source, '\n');
+
+    fox_bench_register("str/sb_appendf", bench_sb_appendf, NULL);
+    fox_bench_register("str/ssb_short", bench_ssb_short, NULL);
+    fox_bench_register("str/split_lines", bench_str_split, NULL);
+    fox_bench_register("str/trim_lines", bench_str_trim, NULL);
+    fox_bench_register("str/intern_lines", bench_intern, NULL);
+    fox_bench_register("str/cmd_build_sb", bench_cmd_build_sb, NULL);
+    fox_bench_register("str/cmd_build_ssb", bench_cmd_build_ssb, NULL);
+    fox_bench_register("hash/lines", bench_hash_short, NULL);
+    fox_bench_register("hash/bulk", bench_hash_bulk, NULL);
+    fox_bench_register("hash/bulk_128", bench_hash128_bulk, NULL);
+    fox_bench_register("hash/streaming_bulk", bench_hasher_bulk, NULL);
+    fox_bench_register("hash/file", bench_fs_hash_file, NULL);
+    fox_bench_register("da/append_4k", bench_da_append, NULL);
+    fox_bench_register("da/small_append_16", bench_da_small_append, NULL);
+    fox_bench_register("da/arena_append_4k", bench_arena_append, NULL);
+    fox_bench_register("da/parallel_reduce_1m", bench_da_parallel_reduce, NULL);
+    fox_bench_register("hm/put_get_lines", bench_hm_put_get, NULL);
+    fox_bench_register("hm/robin_hood_512", bench_hm_put_get_small, NULL);
+    fox_bench_register("hm/linear_scan_512", bench_linear_put_get, NULL);
+    fox_bench_register("hm/chained_512", bench_chained_put_get, NULL);
+    fox_bench_register("queue/mpmc_4x4", bench_mpmc_contention, NULL);
+    fox_bench_register("queue/spsc", bench_spsc_transfer, NULL);
+    fox_bench_register("log/pattern_null_sink", bench_log_pattern, NULL);
+    fox_bench_register("log/disabled_level", bench_log_disabled, NULL);
+    fox_bench_register("log/threads_1", bench_log_threads, (void *) (uintptr_t) 1);
+    fox_bench_register("log/threads_4", bench_log_threads, (void *) (uintptr_t) 4);
+    fox_bench_register("log/threads_32", bench_log_threads, (void *) (uintptr_t) 32);
+    fox_bench_register("fs/read_entire_file", bench_fs_read_entire_file, NULL);
+    fox_bench_register("fs/read_entire_dir", bench_fs_read_entire_dir, NULL);
+    fox_bench_register("fs/read_entire_dir_ssb", bench_fs_read_entire_dir_ssb, NULL);
+    fox_bench_register("cmd/run_true", bench_cmd_run, NULL);
+
+    int result = fox_bench_main(argc, argv);
+    fox_da_free(&source_lines);
+    fox_sb_free(&source);
+    return result;
+}
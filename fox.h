@@ -24,11 +24,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
+#include <time.h>
 
 // TODO: To be implemented next
 // - Implement path functions (concat, filename, rootpath and extension)
 // - Implement async cmd execution
-// - Implement log pattern just like spdlog
 // - Log errors wherever necessary (with #ifndef FOX_NO_ECHO)
 // - Document the header file
 // - fox_fs_canonical does not work on Windows
@@ -44,6 +44,11 @@
 /// - u64
 /// - FoxReallocFn
 /// - fox_realloc
+/// - FoxDaAllocHookFn
+/// - fox_da_alloc_hook
+/// - FoxAllocStats (only with FOX_TRACK_ALLOCS)
+/// - fox_alloc_stats
+/// - fox_alloc_report
 /// - FOX_UNUSED
 /// - FOX_TODO
 /// - FOX_UNREACHABLE
@@ -56,6 +61,8 @@
 /// - fox__realloc__
 /// - fox__rotate_left__
 /// - fox__rotate_right__
+/// - fox__da_grow_capacity__
+/// - fox__flush_on_panic__
 /// - fox__sb_copy__
 /// - fox__str_find_first_of__
 /// - fox__str_find_first_not_of__
@@ -71,14 +78,26 @@
 /// - fox__str_trim_left__
 /// - fox__str_trim_right__
 /// - fox__str_trim__
+/// - fox__str_hash__
+/// - fox__default_logger__
+/// - fox__hm_find__
+/// - fox__hm_insert__
+/// - fox__hm_remove__
+/// - fox__hm_rehash__
+/// - fox__hm_skip__
 /// - fox__cmd_append__
 ///
 /// Dynamic array utils
+/// - FoxSmallArray
+/// - FOX_DA_INLINE
+/// - fox_da_small_init
+/// - fox_da_capacity
 /// - fox_da_foreach
 /// - fox_da_front
 /// - fox_da_back
 /// - fox_da_reserve
 /// - fox_da_resize
+/// - fox_da_shrink_to_fit
 /// - fox_da_free
 /// - fox_da_clone
 /// - fox_da_copy
@@ -107,6 +126,7 @@
 ///   - fox_sb_from_char
 ///   - fox_sb_from_sv
 ///   - fox_sb_copy
+///   - fox_sb_shrink_to_fit
 ///   - fox_sb_free
 ///
 ///   - fox_sv_from_raw
@@ -149,22 +169,186 @@
 ///   - fox_str_trim_right
 ///   - fox_str_trim
 ///
+///   Small strings
+///   - FoxSmallStringBuf
+///   - FoxSmallStringBufs
+///   - fox_ssb_from_chars
+///   - fox_ssb_from_cstr
+///   - fox_ssb_from_sv
+///   - fox_ssb
+///   - fox_ssb_data
+///   - fox_ssb_size
+///   - fox_ssb_reserve
+///   - fox_ssb_clear
+///   - fox_ssb_free
+///   - fox_ssb_concat_sv
+///   - fox_ssb_concat
+///   - fox_ssb_appendf
+///   - fox_ssb_vappendf
+///   - fox_ssb_to_sb
+///   - fox_sv_from_ssb
+///
+///   String interning
+///   - FoxInterner
+///   - FoxInternerOpt
+///   - fox_interner_init_opt
+///   - fox_interner_init
+///   - fox_interner_free
+///   - fox_intern_sv
+///   - fox_intern
+///   - fox_interned_eq
+///
 ///   TODO: do something about error reporting
 ///   fox_get_error_message
 ///
+/// Hash map utils
+/// - fox_hm_foreach
+/// - fox_hm_get
+/// - fox_hm_contains
+/// - fox_hm_put
+/// - fox_hm_remove
+/// - fox_hm_reserve
+/// - fox_hm_rehash
+/// - fox_hm_clear
+/// - fox_hm_free
+///
+/// Arena allocator
+/// - FoxArena
+/// - FoxArenaMark
+/// - fox_arena_alloc
+/// - fox_arena_realloc
+/// - fox_arena_sv_dup
+/// - fox_arena_strdup
+/// - fox_arena_mark
+/// - fox_arena_rewind
+/// - fox_arena_reset
+/// - fox_arena_free
+/// - fox_arena_scope_begin
+/// - fox_arena_scope_end
+///
+/// Thread pool
+/// - FoxTaskFn
+/// - FoxTask
+/// - FoxTasks
+/// - FoxWaitGroup
+/// - fox_wait_group_init
+/// - fox_wait_group_add
+/// - fox_wait_group_done
+/// - fox_wait_group_wait
+/// - fox_wait_group_free
+/// - FoxThreadPool
+/// - FoxThreadPoolOpt
+/// - fox_thread_pool_init_opt
+/// - fox_thread_pool_init
+/// - fox_thread_pool_submit
+/// - fox_thread_pool_submit_wg
+/// - fox_thread_pool_free
+/// - fox_default_thread_pool
+/// - FoxParallelOpt
+/// - fox_parallel_for
+/// - fox_parallel_reduce
+/// - fox_da_parallel_for
+/// - fox_da_parallel_reduce
+///
+/// Concurrent queues
+/// - FoxMpmcQueue
+/// - fox_mpmc_init
+/// - fox_mpmc_free
+/// - fox_mpmc_try_push
+/// - fox_mpmc_try_pop
+/// - fox_mpmc_push
+/// - fox_mpmc_pop
+/// - FoxSpscRing
+/// - fox_spsc_init
+/// - fox_spsc_free
+/// - fox_spsc_try_push
+/// - fox_spsc_try_pop
+/// - fox_spsc_push
+/// - fox_spsc_pop
+///
+/// Metrics
+/// - FoxCounter
+/// - fox_counter_add
+/// - fox_counter_value
+/// - FoxGauge
+/// - fox_gauge_set
+/// - fox_gauge_add
+/// - fox_gauge_value
+/// - FoxHistogram
+/// - fox_histogram_record
+/// - fox_histogram_percentile
+/// - fox_metrics_counter
+/// - fox_metrics_gauge
+/// - fox_metrics_histogram
+/// - fox_metrics_add
+/// - fox_metrics_set
+/// - fox_metrics_record
+/// - FoxMetricsFormat
+/// - fox_metrics_format
+/// - fox_metrics_snapshot
+/// - fox_metrics_snapshot_every
+/// - fox_metrics_stop
+///
+/// Hashing
+/// - fox_hash_bytes
+/// - FoxHash128
+/// - fox_hash128_bytes
+/// - fox_str_hash
+/// - FoxHasher
+/// - fox_hasher_init
+/// - fox_hasher_update
+/// - fox_hasher_digest
+/// - fox_fs_hash_file
+/// - fox_fs_hash_files
+///
+/// Tree diff and dedup
+/// - FoxTreeDiff
+/// - FoxTreeDiffOpt
+/// - fox_fs_tree_diff_opt
+/// - fox_fs_tree_diff
+/// - fox_tree_diff_free
+/// - FoxDuplicates
+/// - FoxDedupOpt
+/// - fox_fs_find_duplicates_opt
+/// - fox_fs_find_duplicates
+/// - fox_duplicates_free
+///
 /// Logging system
 /// - FoxLogLevel
 /// - FoxLogHandlerFn
 /// - FoxSinkWriteFn
 /// - FoxSinkCloseFn
+/// - FoxSinkFlushFn
+/// - FoxLogPatternOp
+/// - FoxLogPattern
 /// - FoxSink
 /// - FoxSinks
 /// - FoxLogger
 ///
+///   Log pattern functions
+///   - fox_log_pattern_compile
+///   - fox_log_pattern_format
+///   - fox_log_pattern_free
+///   - fox_sink_pattern
+///
 ///   Logger functions
+///   - FoxFileSinkOpt
+///   - fox_logger_file_sink_opt
 ///   - fox_logger_file_sink
+///   - FoxAsyncOverflow
+///   - FoxAsyncSinkOpt
+///   - fox_logger_async_sink_opt
+///   - fox_logger_async_sink
+///   - FoxBinaryLogEntry
+///   - fox_binary_log_handler
+///   - fox_binary_log_decode
+///   - fox_logger_binary_sink
+///   - fox_logger_binary_file_sink
 ///   - fox_logger_handler
 ///   - fox_logger_min_level
+///   - fox_logger_enabled
+///   - fox_logger_pattern
+///   - fox_logger_flush
 ///   - fox_logger_free
 ///   - fox_logger_vlog_ext
 ///   - fox_logger_vlog
@@ -183,6 +367,7 @@
 ///   - fox_vlog_ext
 ///   - fox_vlog
 ///   - fox_log_ext
+///   - fox_log_enabled
 ///   - fox_log
 ///   - fox_log_trace
 ///   - fox_log_info
@@ -190,12 +375,21 @@
 ///   - fox_log_error
 ///   - fox_log_critical
 ///
+///   Rate limiting functions
+///   - FoxLogLimiter
+///   - fox_log_limiter_allow
+///   - fox_log_limited
+///   - fox_log_every_n
+///   - fox_logger_log_limited
+///   - fox_logger_log_every_n
+///
 /// Filesystem utils
 ///   Convenience functions
 ///   - fox_fs_read_entire_file
 ///   - fox_fs_write_entire_file
 ///   - fox_fs_read_symlink
 ///   - fox_fs_read_entire_dir
+///   - fox_fs_read_entire_dir_ssb
 ///
 ///   Directory visit functions
 ///   - FoxVisitAction
@@ -280,6 +474,39 @@
 ///   - FoxCmdOpt
 ///   - fox_cmd_run_opt
 ///   - fox_nprocessors
+///   - fox_time_ns
+///
+/// Futures
+/// - FoxFuture
+/// - fox_future_async
+/// - fox_future_then
+/// - fox_future_is_ready
+/// - fox_future_result
+/// - fox_future_wait
+/// - fox_future_wait_timeout
+/// - fox_future_wait_all
+/// - fox_future_wait_any
+/// - fox_future_free
+/// - fox_cmd_run_async_opt
+/// - fox_cmd_run_async
+/// - fox_fs_read_entire_file_async
+/// - fox_fs_copy_file_async
+///
+/// Benchmarking
+/// - FoxBench
+/// - FoxBenchFn
+/// - FoxBenchResult
+/// - FoxBenchOpt
+/// - fox_bench_register
+/// - fox_bench_run_all_opt
+/// - fox_bench_run_all
+/// - fox_bench_main
+/// - fox_do_not_optimize
+///
+/// Profiling (only with FOX_PROFILE)
+/// - FOX_ZONE
+/// - fox_profile_report
+/// - fox_profile_reset
 
 #if defined(_WIN32) || defined(_WIN64)
 #    define FOX_OS_WINDOWS /// Windows
@@ -336,24 +563,70 @@ typedef uint64_t u64;
 void *fox__realloc__(void *p, size_t size);
 void fox__rotate_left__(void *v_data, size_t item_size, size_t items_count, size_t n);
 void fox__rotate_right__(void *v_data, size_t item_size, size_t items_count, size_t n);
+size_t fox__da_grow_capacity__(size_t capacity, size_t required, size_t item_size);
+// Writes out what the file sinks still buffer, called right before aborting
+void fox__flush_on_panic__(void);
 
 // Configurable realloc fn
 typedef void *(*FoxReallocFn)(void *p, size_t size);
 FoxReallocFn fox_realloc = fox__realloc__;
 
+// Memory accounting hook, called whenever a dynamic array changes its capacity
+// with the old and the new size of its storage in bytes.
+// Usage:
+//     static atomic_size_t footprint = 0;
+//     static void account(size_t old_bytes, size_t new_bytes) {
+//         atomic_fetch_add(&footprint, new_bytes);
+//         atomic_fetch_sub(&footprint, old_bytes);
+//     }
+//     // Later ...
+//     fox_da_alloc_hook = account;
+typedef void (*FoxDaAllocHookFn)(size_t old_bytes, size_t new_bytes);
+FoxDaAllocHookFn fox_da_alloc_hook = NULL;
+
+// Define FOX_TRACK_ALLOCS to record every allocation that fox makes through fox_realloc,
+// per call site (the file and line that expanded the fox_da_* macro).
+// The statistics are printed with a leak report at exit, or with fox_alloc_report.
+// Allocations that go into an arena scope are not tracked, neither is the state fox keeps
+// until the process exits (the default log pattern and the per-thread log buffers).
+#ifdef FOX_TRACK_ALLOCS
+typedef struct {
+    size_t allocs;   // New blocks
+    size_t reallocs; // Blocks that grew
+    size_t frees;
+    size_t bytes;      // Total bytes requested by allocs and reallocs
+    size_t live_bytes; // Bytes allocated but not yet freed
+    size_t peak_bytes; // Highest live_bytes
+    size_t live_blocks;
+} FoxAllocStats;
+
+void *fox__track_realloc__(void *p, size_t size, const char *file, int line);
+#    define fox__realloc_site__(p, size) fox__track_realloc__((p), (size), __FILE__, __LINE__)
+/// Totals over all call sites
+FoxAllocStats fox_alloc_stats(void);
+/// Prints the call sites with the most allocations, followed by the blocks that are still alive
+void fox_alloc_report(FILE *out);
+#else
+#    define fox__realloc_site__(p, size) fox_realloc((p), (size))
+#    define fox_alloc_report(out) ((void) (out))
+#endif // FOX_TRACK_ALLOCS
+
 #define FOX_UNUSED(value) (void) (value)
 #define FOX_TODO(msg)                                                                                                                                \
     do {                                                                                                                                             \
         fprintf(stderr, "%s:%d: TODO: %s\n", __FILE__, __LINE__, msg);                                                                               \
+        fox__flush_on_panic__();                                                                                                                     \
         abort();                                                                                                                                     \
     } while (false)
 #define FOX_UNREACHABLE(msg)                                                                                                                         \
     do {                                                                                                                                             \
         fprintf(stderr, "%s:%d: UNREACHABLE: %s\n", __FILE__, __LINE__, msg);                                                                        \
+        fox__flush_on_panic__();                                                                                                                     \
         abort();                                                                                                                                     \
     } while (false)
-#define FOX_PANIC(msg) (fprintf(stderr, "%s:%d: PANIC: %s\n", __FILE__, __LINE__, (msg)), abort())
-#define FOX_ASSERT(cond, msg) ((cond) ? (void) 0 : (fprintf(stderr, "%s:%d: ASSERT: %s\n", __FILE__, __LINE__, (msg)), abort()))
+#define FOX_PANIC(msg) (fprintf(stderr, "%s:%d: PANIC: %s\n", __FILE__, __LINE__, (msg)), fox__flush_on_panic__(), abort())
+#define FOX_ASSERT(cond, msg)                                                                                                                        \
+    ((cond) ? (void) 0 : (fprintf(stderr, "%s:%d: ASSERT: %s\n", __FILE__, __LINE__, (msg)), fox__flush_on_panic__(), abort()))
 #define FOX_ARRLEN(array) (sizeof(array) / sizeof(array[0]))
 
 #define fox_return_defer(value)                                                                                                                      \
@@ -372,6 +645,7 @@ FoxReallocFn fox_realloc = fox__realloc__;
 #    define FOX_ARRAY_INITIAL_CAP 8
 #endif // FOX_ARRAY_INITIAL_CAP
 
+// INFO: The growth factor can be fractional (like 1.5)
 #ifndef FOX_ARRAY_GROWTH_FACTOR
 #    define FOX_ARRAY_GROWTH_FACTOR 2
 #endif // FOX_ARRAY_GROWTH_FACTOR
@@ -394,20 +668,63 @@ FoxReallocFn fox_realloc = fox__realloc__;
 ///     }
 ///     // Do whatever you want...
 
+/// Small arrays embed N items and only spill to the heap once they outgrow them.
+/// They work with every fox_da_* macro after being initialized with fox_da_small_init.
+///     typedef FoxSmallArray(FoxStringView, 8) SmallViews;
+///
+///     // Later ...
+///     SmallViews views;
+///     fox_da_small_init(&views);
+///     fox_da_append(&views, fox_sv("hello")); // No allocation
+///     fox_da_free(&views);
+/// INFO: A small array must not be copied or moved while it uses its inline storage.
+/// The top bit of capacity (FOX_DA_INLINE) tells that items points to the inline storage,
+/// use fox_da_capacity() to read the actual capacity of any dynamic array.
+#define FoxSmallArray(Type, N)                                                                                                                       \
+    struct {                                                                                                                                         \
+        Type *items;                                                                                                                                 \
+        size_t size;                                                                                                                                 \
+        size_t capacity;                                                                                                                             \
+        Type inline_items[N];                                                                                                                        \
+    }
+
+#define FOX_DA_INLINE ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+#define fox_da_small_init(arr)                                                                                                                       \
+    do {                                                                                                                                             \
+        (arr)->items = (arr)->inline_items;                                                                                                          \
+        (arr)->size = 0;                                                                                                                             \
+        (arr)->capacity = FOX_ARRLEN((arr)->inline_items) | FOX_DA_INLINE;                                                                           \
+    } while (false)
+#define fox_da_capacity(arr) ((arr)->capacity & ~FOX_DA_INLINE)
+
 #define fox_da_foreach(Type, it, arr) for (Type *it = (arr)->items; it < (arr)->items + (arr)->size; ++it)
 #define fox_da_front(arr) (FOX_ASSERT((arr)->size > 0, "array cannot be empty"), (arr)->items[0])
 #define fox_da_back(arr) (FOX_ASSERT((arr)->size > 0, "array cannot be empty"), (arr)->items[(arr)->size - 1])
 
+#define fox__da_account__(old_bytes, new_bytes)                                                                                                      \
+    do {                                                                                                                                             \
+        if (fox_da_alloc_hook)                                                                                                                       \
+            fox_da_alloc_hook((old_bytes), (new_bytes));                                                                                             \
+    } while (false)
+
 #define fox_da_reserve(arr, new_cap)                                                                                                                 \
     do {                                                                                                                                             \
-        if ((new_cap) > (arr)->capacity) {                                                                                                           \
-            if ((arr)->capacity == 0)                                                                                                                \
-                (arr)->capacity = FOX_ARRAY_INITIAL_CAP;                                                                                             \
-            while ((new_cap) > (arr)->capacity)                                                                                                      \
-                (arr)->capacity *= 2;                                                                                                                \
+        if ((new_cap) > fox_da_capacity(arr)) {                                                                                                      \
+            bool fox__inline__ = ((arr)->capacity & FOX_DA_INLINE) != 0;                                                                             \
+            size_t fox__old_cap__ = fox__inline__ ? 0 : (arr)->capacity;                                                                             \
+            (arr)->capacity = fox__da_grow_capacity__(fox_da_capacity(arr), (new_cap), sizeof((arr)->items)[0]);                                     \
             FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                           \
-            (arr)->items = fox_realloc((arr)->items, (arr)->capacity * sizeof((arr)->items)[0]);                                                     \
-            FOX_ASSERT((arr)->items != NULL, "realloc failed");                                                                                      \
+            if (fox__inline__) {                                                                                                                     \
+                /* Spill the inline items to the heap */                                                                                             \
+                void *fox__items__ = fox__realloc_site__(NULL, (arr)->capacity * sizeof((arr)->items)[0]);                                           \
+                FOX_ASSERT(fox__items__ != NULL, "realloc failed");                                                                                  \
+                memcpy(fox__items__, (arr)->items, (arr)->size * sizeof((arr)->items)[0]);                                                           \
+                (arr)->items = fox__items__;                                                                                                         \
+            } else {                                                                                                                                 \
+                (arr)->items = fox__realloc_site__((arr)->items, (arr)->capacity * sizeof((arr)->items)[0]);                                         \
+                FOX_ASSERT((arr)->items != NULL, "realloc failed");                                                                                  \
+            }                                                                                                                                        \
+            fox__da_account__(fox__old_cap__ * sizeof((arr)->items)[0], (arr)->capacity * sizeof((arr)->items)[0]);                                  \
         }                                                                                                                                            \
     } while (false)
 
@@ -417,21 +734,40 @@ FoxReallocFn fox_realloc = fox__realloc__;
         (arr)->size = (new_size);                                                                                                                    \
     } while (false)
 
+/// Gives back the unused capacity. Use fox_sb_shrink_to_fit for string buffers
+/// because this does not keep space for the null character.
+#define fox_da_shrink_to_fit(arr)                                                                                                                    \
+    do {                                                                                                                                             \
+        if (((arr)->capacity & FOX_DA_INLINE) == 0 && (arr)->capacity > (arr)->size) {                                                               \
+            size_t fox__old_cap__ = (arr)->capacity;                                                                                                 \
+            FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                           \
+            (arr)->items = fox__realloc_site__((arr)->items, (arr)->size * sizeof((arr)->items)[0]);                                                 \
+            FOX_ASSERT((arr)->size == 0 || (arr)->items != NULL, "realloc failed");                                                                  \
+            (arr)->capacity = (arr)->size;                                                                                                           \
+            fox__da_account__(fox__old_cap__ * sizeof((arr)->items)[0], (arr)->capacity * sizeof((arr)->items)[0]);                                  \
+        }                                                                                                                                            \
+    } while (false)
+
+// INFO: Freeing a small array that still uses its inline storage only empties it
 #define fox_da_free(arr)                                                                                                                             \
     do {                                                                                                                                             \
-        (arr)->size = (arr)->capacity = 0;                                                                                                           \
-        FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                               \
-        (arr)->items = fox_realloc((arr)->items, 0);                                                                                                 \
+        if ((arr)->capacity & FOX_DA_INLINE) {                                                                                                       \
+            (arr)->size = 0;                                                                                                                         \
+        } else {                                                                                                                                     \
+            fox__da_account__((arr)->capacity * sizeof((arr)->items)[0], 0);                                                                         \
+            (arr)->size = (arr)->capacity = 0;                                                                                                       \
+            FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                           \
+            (arr)->items = fox__realloc_site__((arr)->items, 0);                                                                                     \
+        }                                                                                                                                            \
     } while (false)
 
 #define fox_da_copy(dest, src)                                                                                                                       \
     do {                                                                                                                                             \
-        (dest)->size = (src)->size;                                                                                                                  \
-        (dest)->capacity = (src)->capacity;                                                                                                          \
-        FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                               \
-        (dest)->items = fox_realloc((dest)->items, (dest)->capacity * sizeof((dest)->items[0]));                                                     \
+        fox_da_clear(dest);                                                                                                                          \
+        fox_da_reserve((dest), fox_da_capacity(src));                                                                                                \
         if ((src)->items)                                                                                                                            \
             memcpy((dest)->items, (src)->items, (src)->size * sizeof((src)->items[0]));                                                              \
+        (dest)->size = (src)->size;                                                                                                                  \
     } while (false)
 
 #define fox_da_clear(arr)                                                                                                                            \
@@ -535,6 +871,31 @@ typedef struct {
     size_t capacity;
 } FoxStringViews;
 
+// INFO: SmallStringBuf stores strings of up to FOX_SSO_CAPACITY bytes
+// inline without touching the heap, in the bytes that hold items, size and
+// capacity once it outgrows the inline storage. The last byte holds the
+// inline size, its top bit marks a heap string (the heap capacity carries
+// that bit). Always go through fox_ssb_data(), fox_ssb_size() or fox_sv()
+// to get to the characters. A zero-initialized SmallStringBuf is empty.
+
+typedef union {
+    struct {
+        char *items;
+        size_t size;
+        size_t capacity; // Tagged, see fox__ssb_capacity__
+    } heap;
+    char small[sizeof(char *) + 2 * sizeof(size_t)];
+} FoxSmallStringBuf;
+
+// One byte for the null character, one for the size
+#define FOX_SSO_CAPACITY (sizeof(FoxSmallStringBuf) - 2)
+
+typedef struct {
+    FoxSmallStringBuf *items;
+    size_t size;
+    size_t capacity;
+} FoxSmallStringBufs;
+
 void fox__sb_copy__(FoxStringBuf *dest, FoxStringView src);
 size_t fox__str_find_first_of__(FoxStringView self, FoxStringView str);
 size_t fox__str_find_first_not_of__(FoxStringView self, FoxStringView str);
@@ -550,6 +911,7 @@ FoxStringViews fox__str_split__(FoxStringView str, char delimiter);
 FoxStringView fox__str_trim_left__(FoxStringView str);
 FoxStringView fox__str_trim_right__(FoxStringView str);
 FoxStringView fox__str_trim__(FoxStringView str);
+u64 fox__str_hash__(FoxStringView str);
 
 // Construction
 FoxStringBuf fox_sb_from_chars(const char *data, size_t count);
@@ -558,6 +920,7 @@ FoxStringBuf fox_sb_from_char(char c, size_t count);
 FoxStringBuf fox_sb_from_sv(FoxStringView sv);
 FoxStringBuf fox_sb_clone(const FoxStringBuf *sb);
 #define fox_sb_copy(dest, src) fox__sb_copy__((dest), fox_sv(src))
+void fox_sb_shrink_to_fit(FoxStringBuf *sb);
 void fox_sb_free(FoxStringBuf *sb);
 #define fox_str_bufs_free(str_bufs)                                                                                                                  \
     do {                                                                                                                                             \
@@ -572,8 +935,16 @@ FoxStringView fox_sv_from_cstr(const char *str);
 FoxStringView fox_sv_from_sb(const FoxStringBuf sb);
 FoxStringView fox_sv_from_sv(FoxStringView sv);
 
+FoxStringView fox_sv_from_ssb(const FoxSmallStringBuf *ssb);
+
 #define fox_sv(expr)                                                                                                                                 \
-    _Generic((expr), char *: fox_sv_from_cstr, const char *: fox_sv_from_cstr, FoxStringBuf: fox_sv_from_sb, FoxStringView: fox_sv_from_sv)(expr)
+    _Generic((expr),                                                                                                                                 \
+            char *: fox_sv_from_cstr,                                                                                                                \
+            const char *: fox_sv_from_cstr,                                                                                                          \
+            FoxStringBuf: fox_sv_from_sb,                                                                                                            \
+            FoxStringView: fox_sv_from_sv,                                                                                                           \
+            FoxSmallStringBuf *: fox_sv_from_ssb,                                                                                                    \
+            const FoxSmallStringBuf *: fox_sv_from_ssb)(expr)
 
 // Modification
 void fox_sb_pop(FoxStringBuf *sb);
@@ -644,18 +1015,642 @@ void fox_sb_toupper(FoxStringBuf *sb);
 ///   StringView sv = ...;
 ///   printf("sv: "SV_Arg"\n", SV_Arg(sv));
 
+// Small strings
+FoxSmallStringBuf fox_ssb_from_chars(const char *data, size_t count);
+FoxSmallStringBuf fox_ssb_from_cstr(const char *str);
+FoxSmallStringBuf fox_ssb_from_sv(FoxStringView sv);
+#define fox_ssb(expr) _Generic((expr), char *: fox_ssb_from_cstr, const char *: fox_ssb_from_cstr, FoxStringView: fox_ssb_from_sv)(expr)
+#define fox__ssb_is_heap__(ssb) ((((const unsigned char *) (ssb))[sizeof(FoxSmallStringBuf) - 1] & 0x80) != 0)
+#define fox_ssb_data(ssb) (fox__ssb_is_heap__(ssb) ? (ssb)->heap.items : (ssb)->small)
+size_t fox_ssb_size(const FoxSmallStringBuf *ssb);
+void fox_ssb_reserve(FoxSmallStringBuf *ssb, size_t count);
+void fox_ssb_clear(FoxSmallStringBuf *ssb);
+void fox_ssb_free(FoxSmallStringBuf *ssb);
+#define fox_small_str_bufs_free(ssbs)                                                                                                                \
+    do {                                                                                                                                             \
+        fox_da_foreach(FoxSmallStringBuf, fox__ssb__, (ssbs)) { fox_ssb_free(fox__ssb__); }                                                          \
+        fox_da_free((ssbs));                                                                                                                         \
+    } while (false)
+
+void fox_ssb_concat_sv(FoxSmallStringBuf *ssb, FoxStringView other);
+#define fox_ssb_concat(ssb, other) fox_ssb_concat_sv((ssb), fox_sv(other))
+void fox_ssb_appendf(FoxSmallStringBuf *ssb, const char *fmt, ...) FOX_PRINTF_FORMAT(2, 3);
+void fox_ssb_vappendf(FoxSmallStringBuf *ssb, const char *fmt, va_list args);
+/// Moves the contents into a heap allocated StringBuf and resets @p ssb
+FoxStringBuf fox_ssb_to_sb(FoxSmallStringBuf *ssb);
+
+// String interning
+
+#ifndef FOX_INTERNER_CHUNK_SIZE
+#    define FOX_INTERNER_CHUNK_SIZE (64 * 1024)
+#endif // FOX_INTERNER_CHUNK_SIZE
+
+#ifndef FOX_INTERNER_INITIAL_CAP
+#    define FOX_INTERNER_INITIAL_CAP 64
+#endif // FOX_INTERNER_INITIAL_CAP
+
+// INFO: Interned strings are null terminated and never move, so the views
+// (and their items as const char *) stay valid until the interner is freed.
+// Two interned strings are equal if and only if their items are equal.
+
+struct FoxInternChunk;
+
+typedef struct {
+    FoxStringView sv;
+    u64 hash;
+} FoxInternSlot;
+
+typedef struct {
+    FoxInternSlot *slots;
+    size_t size;
+    size_t capacity;
+    struct FoxInternChunk *chunks;
+    mtx_t mtx;
+} FoxInternShard;
+
+typedef struct {
+    FoxInternShard local;
+    FoxInternShard *shards;
+    size_t shard_count;
+} FoxInterner;
+
+typedef struct {
+    /// Number of independently locked shards, 0 means the interner is not thread safe
+    size_t shards;
+} FoxInternerOpt;
+
+/// A zero-initialized interner is a valid single threaded interner.
+/// Initialization is only needed for the thread safe (sharded) mode.
+bool fox_interner_init_opt(FoxInterner *interner, FoxInternerOpt opt);
+#define fox_interner_init(interner, ...) fox_interner_init_opt((interner), (FoxInternerOpt) {__VA_ARGS__})
+void fox_interner_free(FoxInterner *interner);
+FoxStringView fox_intern_sv(FoxInterner *interner, FoxStringView sv);
+#define fox_intern(interner, str) fox_intern_sv((interner), fox_sv(str))
+#define fox_interned_eq(left, right) ((left).items == (right).items)
+
 FoxStringView fox_get_error_message(void);
 
+// Hash map utils
+
+#ifndef FOX_HASHMAP_INITIAL_CAP
+#    define FOX_HASHMAP_INITIAL_CAP 16
+#endif // FOX_HASHMAP_INITIAL_CAP
+
+#ifndef FOX_HASHMAP_MAX_LOAD
+#    define FOX_HASHMAP_MAX_LOAD 85 // in percent
+#endif // FOX_HASHMAP_MAX_LOAD
+
+/// Any hash map is defined as follows:
+///     typedef struct {
+///         FoxStringView key; // The key must be the first member
+///         int value;
+///         // your other members...
+///     } Entry;
+///
+///     typedef struct {
+///         Entry *items;
+///         u32 *hashes;
+///         size_t size;
+///         size_t capacity;
+///     } Map;
+///
+///     // Later ...
+///     Map map = {0}; // Zero-initialized value is default value
+///     fox_hm_put(&map, "main.c", 1);
+///     Entry *entry = fox_hm_get(&map, "main.c");
+///     fox_hm_foreach(Entry, it, &map) {
+///         printf(SV_Fmt " => %d\n", SV_Arg(it->key), it->value);
+///     }
+///     fox_hm_free(&map);
+///
+/// INFO: The map uses Robin Hood hashing with linear probing, so removing
+/// shifts the following entries back instead of leaving tombstones.
+/// The map does not own the keys, they must outlive the entries (see FoxInterner).
+/// Entries move around when the map is modified, do not keep pointers to them.
+
+size_t fox__hm_find__(const void *items, const u32 *hashes, size_t capacity, size_t item_size, FoxStringView key);
+size_t fox__hm_insert__(void *items, u32 *hashes, size_t capacity, size_t item_size, size_t *size, FoxStringView key);
+bool fox__hm_remove__(void *items, u32 *hashes, size_t capacity, size_t item_size, size_t *size, FoxStringView key);
+void fox__hm_rehash__(void **items, u32 **hashes, size_t *capacity, size_t item_size, size_t size, size_t new_cap);
+/// Index of the first occupied slot at or after @p index, @p capacity if there is none
+size_t fox__hm_skip__(const u32 *hashes, size_t capacity, size_t index);
+
+// Empty slots are skipped in the loop header, so the body behaves like any other statement (no dangling else)
+#define fox_hm_foreach(Type, it, map)                                                                                                                \
+    for (Type *it = (map)->items + fox__hm_skip__((map)->hashes, (map)->capacity, 0); it < (map)->items + (map)->capacity;                           \
+         it = (map)->items + fox__hm_skip__((map)->hashes, (map)->capacity, (size_t) (it - (map)->items) + 1))
+
+#define fox__hm_index__(map, key) fox__hm_find__((map)->items, (map)->hashes, (map)->capacity, sizeof((map)->items[0]), fox_sv(key))
+/// Returns a pointer to the entry or NULL if the key is not present
+#define fox_hm_get(map, key) fox__hm_get__((map)->items, fox__hm_index__((map), (key)), (map)->capacity, sizeof((map)->items[0]))
+#define fox_hm_contains(map, key) (fox__hm_index__((map), (key)) != (map)->capacity)
+#define fox_hm_remove(map, key)                                                                                                                      \
+    fox__hm_remove__((map)->items, (map)->hashes, (map)->capacity, sizeof((map)->items[0]), &(map)->size, fox_sv(key))
+
+static inline void *fox__hm_get__(void *items, size_t index, size_t capacity, size_t item_size) {
+    return index == capacity ? NULL : (u8 *) items + index * item_size;
+}
+
+/// Resizes the map to hold at least @p new_cap entries, it can also be used to shrink the map
+#define fox_hm_rehash(map, new_cap)                                                                                                                  \
+    do {                                                                                                                                             \
+        void *fox__items__ = (map)->items;                                                                                                           \
+        fox__hm_rehash__(&fox__items__, &(map)->hashes, &(map)->capacity, sizeof((map)->items[0]), (map)->size, (new_cap));                          \
+        (map)->items = fox__items__;                                                                                                                 \
+    } while (false)
+
+#define fox_hm_reserve(map, count)                                                                                                                   \
+    do {                                                                                                                                             \
+        if ((count) * 100 > (map)->capacity * FOX_HASHMAP_MAX_LOAD)                                                                                  \
+            fox_hm_rehash((map), (count));                                                                                                           \
+    } while (false)
+
+/// Inserts or updates the entry with @p key and sets its value member to @p val.
+/// New entries are zero-initialized before the value is set.
+#define fox_hm_put(map, key, val)                                                                                                                    \
+    do {                                                                                                                                             \
+        fox_hm_reserve((map), (map)->size + 1);                                                                                                      \
+        (map)->items[fox__hm_insert__((map)->items, (map)->hashes, (map)->capacity, sizeof((map)->items[0]), &(map)->size, fox_sv(key))].value =    \
+                (val);                                                                                                                               \
+    } while (false)
+
+#define fox_hm_clear(map)                                                                                                                            \
+    do {                                                                                                                                             \
+        if ((map)->hashes)                                                                                                                           \
+            memset((map)->hashes, 0, (map)->capacity * sizeof((map)->hashes[0]));                                                                    \
+        (map)->size = 0;                                                                                                                             \
+    } while (false)
+
+#define fox_hm_free(map)                                                                                                                             \
+    do {                                                                                                                                             \
+        FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");                                                                               \
+        (map)->items = fox__realloc_site__((map)->items, 0);                                                                                         \
+        (map)->hashes = fox__realloc_site__((map)->hashes, 0);                                                                                       \
+        (map)->size = (map)->capacity = 0;                                                                                                           \
+    } while (false)
+
+// Arena allocator
+
+#ifndef FOX_ARENA_CHUNK_SIZE
+#    define FOX_ARENA_CHUNK_SIZE (64 * 1024)
+#endif // FOX_ARENA_CHUNK_SIZE
+
+struct FoxArenaChunk;
+
+/// Zero-initialized value is an empty arena.
+/// Set chunk_size before the first allocation to override FOX_ARENA_CHUNK_SIZE.
+typedef struct {
+    struct FoxArenaChunk *begin;
+    struct FoxArenaChunk *end;
+    size_t chunk_size;
+} FoxArena;
+
+typedef struct {
+    struct FoxArenaChunk *chunk;
+    size_t size;
+} FoxArenaMark;
+
+void *fox_arena_alloc(FoxArena *arena, size_t size);
+/// Behaves like fox_realloc, but @p p must come from @p arena.
+/// Growing the last allocation happens in place, and freeing the last allocation gives back its space.
+void *fox_arena_realloc(FoxArena *arena, void *p, size_t size);
+char *fox_arena_sv_dup(FoxArena *arena, FoxStringView sv);
+#define fox_arena_strdup(arena, str) fox_arena_sv_dup((arena), fox_sv(str))
+FoxArenaMark fox_arena_mark(FoxArena *arena);
+void fox_arena_rewind(FoxArena *arena, FoxArenaMark mark);
+void fox_arena_reset(FoxArena *arena);
+void fox_arena_free(FoxArena *arena);
+
+/// Binds @p arena to the calling thread, so that everything that goes through the
+/// default fox_realloc (all fox_da_* and fox_sb_* functions) is allocated from it.
+/// Memory allocated before the scope keeps living on the heap.
+/// Returns the previously bound arena that must be passed to fox_arena_scope_end.
+/// Usage:
+///     FoxArena arena = {0};
+///     FoxArena *prev = fox_arena_scope_begin(&arena);
+///     // Build temporary arrays and strings...
+///     fox_arena_scope_end(prev);
+///     fox_arena_reset(&arena); // Everything is gone at once
+/// INFO: Anything allocated inside the scope must not be freed
+/// or grown after the scope ends, only the arena can release it.
+/// INFO: State that fox keeps beyond the call always lives on the heap: the default logger
+/// and its pattern, the patterns set with fox_sink_pattern, file sinks, interners
+/// (fox_interner_init and fox_intern) and the registered benchmarks.
+FoxArena *fox_arena_scope_begin(FoxArena *arena);
+void fox_arena_scope_end(FoxArena *prev);
+
+// Thread pool
+
+#ifndef FOX_CACHE_LINE
+#    define FOX_CACHE_LINE 64
+#endif // FOX_CACHE_LINE
+
+#ifndef FOX_POOL_DEQUE_CAP
+#    define FOX_POOL_DEQUE_CAP 256 // Initial capacity of the task deque of each worker
+#endif // FOX_POOL_DEQUE_CAP
+
+typedef void (*FoxTaskFn)(void *arg);
+
+/// Counts outstanding tasks, fox_wait_group_wait blocks until the count drops to zero.
+/// Waiting from inside a task runs other tasks of the pool in the meantime.
+typedef struct {
+    atomic_size_t count;
+    mtx_t mtx;
+    cnd_t cnd;
+} FoxWaitGroup;
+
+bool fox_wait_group_init(FoxWaitGroup *wg);
+void fox_wait_group_add(FoxWaitGroup *wg, size_t count);
+void fox_wait_group_done(FoxWaitGroup *wg);
+void fox_wait_group_wait(FoxWaitGroup *wg);
+void fox_wait_group_free(FoxWaitGroup *wg);
+
+typedef struct {
+    FoxTaskFn fn;
+    void *arg;
+    FoxWaitGroup *wg; // Can be NULL
+} FoxTask;
+
+typedef struct {
+    FoxTask *items;
+    size_t size;
+    size_t capacity;
+} FoxTasks;
+
+struct FoxWorker;
+
+/// Each worker owns a Chase-Lev deque. Tasks submitted from inside a task go to the deque
+/// of the current worker, other threads submit through a shared injection queue.
+/// Idle workers steal from the other deques before they go to sleep.
+typedef struct {
+    struct FoxWorker *workers;
+    size_t worker_count;
+
+    FoxTasks injected;
+    size_t injected_head;
+    mtx_t injected_mtx;
+
+    atomic_size_t pending; // Submitted tasks that did not start yet
+    atomic_size_t sleeping;
+    atomic_bool stop;
+    mtx_t mtx;
+    cnd_t cnd;
+} FoxThreadPool;
+
+typedef struct {
+    size_t threads; // fox_nprocessors() by default
+} FoxThreadPoolOpt;
+
+bool fox_thread_pool_init_opt(FoxThreadPool *pool, FoxThreadPoolOpt opt);
+#define fox_thread_pool_init(pool, ...) fox_thread_pool_init_opt((pool), (FoxThreadPoolOpt) {__VA_ARGS__})
+/// Tasks can be submitted from any thread, including from inside other tasks
+void fox_thread_pool_submit(FoxThreadPool *pool, FoxTaskFn fn, void *arg);
+/// Adds one to @p wg and marks it done after @p fn returns
+void fox_thread_pool_submit_wg(FoxThreadPool *pool, FoxWaitGroup *wg, FoxTaskFn fn, void *arg);
+/// Runs every task that is still queued, then stops the workers.
+/// It must not be called from a task of the same pool.
+void fox_thread_pool_free(FoxThreadPool *pool);
+/// Shared pool with fox_nprocessors() workers, started on the first call and never freed
+FoxThreadPool *fox_default_thread_pool(void);
+
+#ifndef FOX_PARALLEL_CHUNKS
+#    define FOX_PARALLEL_CHUNKS 256 // Number of chunks the parallel helpers aim for when no grain is given
+#endif // FOX_PARALLEL_CHUNKS
+
+typedef struct {
+    FoxThreadPool *pool; // fox_default_thread_pool() by default
+    size_t grain;        // Indices per chunk, by default count / FOX_PARALLEL_CHUNKS rounded up
+} FoxParallelOpt;
+
+/// Called once per chunk with the half open range [begin, end)
+typedef void (*FoxParallelForFn)(void *user, size_t begin, size_t end);
+/// Folds the range [begin, end) into @p partial, which starts zeroed
+typedef void (*FoxParallelReduceFn)(void *user, size_t begin, size_t end, void *partial);
+/// Folds @p partial into @p acc
+typedef void (*FoxParallelCombineFn)(void *user, void *acc, const void *partial);
+
+/// Splits [0, count) into chunks and runs them on the pool, the calling thread helps too.
+/// Chunk boundaries only depend on count and grain, never on the number of threads.
+void fox_parallel_for_opt(size_t count, FoxParallelForFn fn, void *user, FoxParallelOpt opt);
+#define fox_parallel_for(count, fn, user, ...) fox_parallel_for_opt((count), (fn), (user), (FoxParallelOpt) {__VA_ARGS__})
+/// @p result holds the initial value on input. Every chunk folds into a zeroed partial, a zeroed value
+/// must therefore mean "nothing folded yet" (for min/max keep a flag next to the value).
+/// Partials are combined into @p result in chunk order, so the initial value counts exactly once and
+/// the result is deterministic even when @p combine is not associative (e.g. float addition).
+void fox_parallel_reduce_opt(size_t count, FoxParallelReduceFn fn, FoxParallelCombineFn combine, void *user, void *result,
+                             size_t result_size, FoxParallelOpt opt);
+#define fox_parallel_reduce(count, fn, combine, user, result, ...)                                                                                   \
+    fox_parallel_reduce_opt((count), (fn), (combine), (user), (result), sizeof(*(result)), (FoxParallelOpt) {__VA_ARGS__})
+
+typedef void (*FoxDaItemFn)(void *user, void *item, size_t index);
+typedef void (*FoxDaFoldFn)(void *user, const void *item, size_t index, void *partial);
+
+void fox__da_parallel_for__(void *items, size_t size, size_t item_size, FoxDaItemFn fn, void *user, FoxParallelOpt opt);
+void fox__da_parallel_reduce__(const void *items, size_t size, size_t item_size, FoxDaFoldFn fn, FoxParallelCombineFn combine, void *user,
+                               void *result, size_t result_size, FoxParallelOpt opt);
+
+/// Calls `fn(user, &arr->items[i], i)` for every item, in parallel.
+/// Usage:
+///     void stat_one(void *user, void *item, size_t index) { ... }
+///     fox_da_parallel_for(&paths, stat_one, NULL);
+///     fox_da_parallel_for(&paths, stat_one, NULL, .grain = 1);
+#define fox_da_parallel_for(arr, fn, user, ...)                                                                                                      \
+    fox__da_parallel_for__((arr)->items, (arr)->size, sizeof(*(arr)->items), (fn), (user), (FoxParallelOpt) {__VA_ARGS__})
+/// Calls `fn(user, &arr->items[i], i, partial)` for every item, then combines the partials in order into @p result.
+/// Partials start zeroed and the initial value of @p result is combined exactly once (see fox_parallel_reduce).
+/// Usage:
+///     i64 sum = 10;
+///     fox_da_parallel_reduce(&numbers, sum_fold, sum_combine, NULL, &sum); // 10 + the sum of numbers
+#define fox_da_parallel_reduce(arr, fn, combine, user, result, ...)                                                                                  \
+    fox__da_parallel_reduce__((arr)->items, (arr)->size, sizeof(*(arr)->items), (fn), (combine), (user), (result), sizeof(*(result)),           \
+                              (FoxParallelOpt) {__VA_ARGS__})
+
+// Concurrent queues
+
+/// Bounded lock-free queue for any number of producers and consumers (Vyukov).
+/// Every cell carries a sequence number, so producers and consumers only contend on their own counter.
+/// Usage:
+///     FoxMpmcQueue queue;
+///     fox_mpmc_init(&queue, FoxStringView, 1024);
+///     fox_mpmc_push(&queue, &path);      // Blocks while the queue is full
+///     if (fox_mpmc_try_pop(&queue, &path)) { ... }
+///     fox_mpmc_free(&queue);
+typedef struct {
+    atomic_size_t enqueue_pos;
+    char pad_enqueue[FOX_CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t dequeue_pos;
+    char pad_dequeue[FOX_CACHE_LINE - sizeof(atomic_size_t)];
+    u8 *cells;
+    size_t cell_size;
+    size_t item_size;
+    size_t mask;
+} FoxMpmcQueue;
+
+/// @p capacity is rounded up to a power of two
+bool fox__mpmc_init__(FoxMpmcQueue *queue, size_t item_size, size_t capacity);
+bool fox__mpmc_try_push__(FoxMpmcQueue *queue, const void *item, size_t item_size);
+bool fox__mpmc_try_pop__(FoxMpmcQueue *queue, void *item, size_t item_size);
+void fox__mpmc_push__(FoxMpmcQueue *queue, const void *item, size_t item_size);
+void fox__mpmc_pop__(FoxMpmcQueue *queue, void *item, size_t item_size);
+void fox_mpmc_free(FoxMpmcQueue *queue);
+
+#define fox_mpmc_init(queue, Type, capacity) fox__mpmc_init__((queue), sizeof(Type), (capacity))
+/// Copies `*item` into the queue, returns false if it is full
+#define fox_mpmc_try_push(queue, item) fox__mpmc_try_push__((queue), (item), sizeof(*(item)))
+/// Moves the oldest item into `*item`, returns false if the queue is empty
+#define fox_mpmc_try_pop(queue, item) fox__mpmc_try_pop__((queue), (item), sizeof(*(item)))
+#define fox_mpmc_push(queue, item) fox__mpmc_push__((queue), (item), sizeof(*(item)))
+#define fox_mpmc_pop(queue, item) fox__mpmc_pop__((queue), (item), sizeof(*(item)))
+
+/// Bounded wait-free ring for exactly one producer and one consumer thread.
+/// Each side keeps a cached copy of the other side's index and only reloads it when the ring looks full or empty.
+typedef struct {
+    atomic_size_t head; // Next slot to pop, written by the consumer
+    size_t tail_cache;
+    char pad_head[FOX_CACHE_LINE - sizeof(atomic_size_t) - sizeof(size_t)];
+    atomic_size_t tail; // Next slot to push, written by the producer
+    size_t head_cache;
+    char pad_tail[FOX_CACHE_LINE - sizeof(atomic_size_t) - sizeof(size_t)];
+    u8 *items;
+    size_t item_size;
+    size_t mask;
+} FoxSpscRing;
+
+/// @p capacity is rounded up to a power of two
+bool fox__spsc_init__(FoxSpscRing *ring, size_t item_size, size_t capacity);
+bool fox__spsc_try_push__(FoxSpscRing *ring, const void *item, size_t item_size);
+bool fox__spsc_try_pop__(FoxSpscRing *ring, void *item, size_t item_size);
+void fox__spsc_push__(FoxSpscRing *ring, const void *item, size_t item_size);
+void fox__spsc_pop__(FoxSpscRing *ring, void *item, size_t item_size);
+void fox_spsc_free(FoxSpscRing *ring);
+
+#define fox_spsc_init(ring, Type, capacity) fox__spsc_init__((ring), sizeof(Type), (capacity))
+#define fox_spsc_try_push(ring, item) fox__spsc_try_push__((ring), (item), sizeof(*(item)))
+#define fox_spsc_try_pop(ring, item) fox__spsc_try_pop__((ring), (item), sizeof(*(item)))
+#define fox_spsc_push(ring, item) fox__spsc_push__((ring), (item), sizeof(*(item)))
+#define fox_spsc_pop(ring, item) fox__spsc_pop__((ring), (item), sizeof(*(item)))
+
+// Metrics
+
+#ifndef FOX_METRICS_SHARDS
+#    define FOX_METRICS_SHARDS 16 // Threads spread their counter increments over this many cache lines
+#endif // FOX_METRICS_SHARDS
+
+typedef struct {
+    _Alignas(FOX_CACHE_LINE) atomic_ullong value;
+} FoxCounterShard;
+
+/// Monotonic counter. Every thread increments its own shard, reading sums all of them.
+typedef struct {
+    FoxCounterShard shards[FOX_METRICS_SHARDS];
+} FoxCounter;
+
+typedef struct {
+    atomic_llong value;
+} FoxGauge;
+
+// Log-linear buckets (like HDR histograms): every power of two is split into 16 linear
+// sub-buckets, so a recorded value is off by at most 1/16 (6.25%) of its magnitude.
+#define FOX__HISTOGRAM_SUB_BITS__ 4
+#define FOX__HISTOGRAM_BUCKETS__ ((64 - FOX__HISTOGRAM_SUB_BITS__ + 1) << FOX__HISTOGRAM_SUB_BITS__)
+
+/// Records values such as latencies in nanoseconds
+typedef struct {
+    atomic_ullong count;
+    atomic_ullong sum;
+    atomic_ullong max;
+    atomic_ullong buckets[FOX__HISTOGRAM_BUCKETS__];
+} FoxHistogram;
+
+void fox_counter_add(FoxCounter *counter, u64 n);
+u64 fox_counter_value(FoxCounter *counter);
+void fox_gauge_set(FoxGauge *gauge, i64 value);
+void fox_gauge_add(FoxGauge *gauge, i64 delta);
+i64 fox_gauge_value(FoxGauge *gauge);
+void fox_histogram_record(FoxHistogram *histogram, u64 value);
+/// @p percentile goes from 0 to 100, returns the upper bound of the bucket that holds it
+u64 fox_histogram_percentile(FoxHistogram *histogram, double percentile);
+
+/// The registry creates a metric the first time its name is used, the same pointer is returned afterwards.
+/// Metrics live until the process exits. Names use dots, fox's own metrics start with "fox.".
+FoxCounter *fox_metrics_counter(const char *name);
+FoxGauge *fox_metrics_gauge(const char *name);
+FoxHistogram *fox_metrics_histogram(const char *name);
+
+/// Look up the metric only once per call site. The site keeps the first metric it finds,
+/// so @p name must be a string literal (anything else does not compile), use
+/// fox_metrics_counter and friends for names built at runtime.
+/// Usage:
+///     fox_metrics_add("build.files_compiled", 1);
+///     fox_metrics_record("build.compile_ns", fox_time_ns() - start);
+#define fox__metrics_site__(Type, lookup, name)                                                                                                      \
+    static _Atomic(Type *) fox__metric__ = NULL;                                                                                                     \
+    Type *fox__m__ = atomic_load_explicit(&fox__metric__, memory_order_acquire);                                                                     \
+    if (fox__m__ == NULL) {                                                                                                                          \
+        fox__m__ = lookup("" name "");                                                                                                               \
+        atomic_store_explicit(&fox__metric__, fox__m__, memory_order_release);                                                                       \
+    }
+#define fox_metrics_add(name, n)                                                                                                                     \
+    do {                                                                                                                                             \
+        fox__metrics_site__(FoxCounter, fox_metrics_counter, name);                                                                                  \
+        fox_counter_add(fox__m__, (n));                                                                                                              \
+    } while (false)
+#define fox_metrics_set(name, value)                                                                                                                 \
+    do {                                                                                                                                             \
+        fox__metrics_site__(FoxGauge, fox_metrics_gauge, name);                                                                                      \
+        fox_gauge_set(fox__m__, (value));                                                                                                            \
+    } while (false)
+#define fox_metrics_record(name, value)                                                                                                              \
+    do {                                                                                                                                             \
+        fox__metrics_site__(FoxHistogram, fox_metrics_histogram, name);                                                                              \
+        fox_histogram_record(fox__m__, (value));                                                                                                     \
+    } while (false)
+
+// fox reports its own activity (commands, files, log lines) only when FOX_METRICS is defined
+#ifdef FOX_METRICS
+#    define FOX__METRICS_ADD__(name, n) fox_metrics_add(name, (n))
+#    define FOX__METRICS_RECORD__(name, value) fox_metrics_record(name, (value))
+#else
+#    define FOX__METRICS_ADD__(name, n) ((void) 0)
+#    define FOX__METRICS_RECORD__(name, value) ((void) 0)
+#endif // FOX_METRICS
+
+typedef enum {
+    FOX_METRICS_TEXT, // One "name value" line per counter and gauge, histograms add count, sum, max and percentiles
+    FOX_METRICS_JSON,
+} FoxMetricsFormat;
+
+void fox_metrics_format(FoxStringBuf *sb, FoxMetricsFormat format);
+/// Writes to a temporary file first and renames it, readers never see a partial snapshot
+bool fox_metrics_snapshot(const char *path, FoxMetricsFormat format);
+/// Takes a snapshot every @p interval_ms on a background thread until fox_metrics_stop
+bool fox_metrics_snapshot_every(const char *path, FoxMetricsFormat format, u64 interval_ms);
+/// Stops the background snapshots after writing a final one
+void fox_metrics_stop(void);
+
+// Hashing
+
+/// Fast non-cryptographic hash (wyhash), it is used by the hash map and the interner.
+/// The result depends on the byte order of the machine.
+u64 fox_hash_bytes(const void *data, size_t size, u64 seed);
+
+typedef struct {
+    u64 low;
+    u64 high;
+} FoxHash128;
+
+/// For content hashes where 64 bits could collide. The data is read once and feeds two
+/// wyhash lanes with different secrets, so this is two 64-bit hashes side by side rather
+/// than a hash with full 128-bit mixing. It does not match fox_hash_bytes.
+FoxHash128 fox_hash128_bytes(const void *data, size_t size, u64 seed);
+#define fox_str_hash(str) fox__str_hash__(fox_sv(str))
+
+/// Streaming XXH64, for data that arrives in pieces
+/// Usage:
+///     FoxHasher hasher;
+///     fox_hasher_init(&hasher, 0);
+///     fox_hasher_update(&hasher, header.items, header.size);
+///     fox_hasher_update(&hasher, body.items, body.size);
+///     u64 hash = fox_hasher_digest(&hasher);
+typedef struct {
+    u64 acc[4];
+    u64 seed;
+    u64 total;
+    u8 buffer[32];
+    size_t buffered;
+} FoxHasher;
+
+void fox_hasher_init(FoxHasher *hasher, u64 seed);
+void fox_hasher_update(FoxHasher *hasher, const void *data, size_t size);
+u64 fox_hasher_digest(const FoxHasher *hasher);
+
+#ifndef FOX_HASH_CHUNK_SIZE
+#    define FOX_HASH_CHUNK_SIZE (256 * 1024) // Read size when a file cannot be mapped
+#endif // FOX_HASH_CHUNK_SIZE
+
+/// XXH64 (seed 0) of the contents of the file, the file is mapped into memory where possible
+bool fox_fs_hash_file(const char *path, u64 *hash);
+/// Hashes every file on the thread pool, a file that could not be hashed gets 0 and makes it return false
+bool fox_fs_hash_files_opt(const FoxStringBufs *paths, u64 *hashes, FoxParallelOpt opt);
+#define fox_fs_hash_files(paths, hashes, ...) fox_fs_hash_files_opt((paths), (hashes), (FoxParallelOpt) {.grain = 1, __VA_ARGS__})
+
+// Tree diff and dedup
+
+/// Regular files that differ between two directory trees.
+/// The paths are relative to the tree roots, sorted and null terminated.
+typedef struct {
+    FoxStringViews added;   // Only in the new tree
+    FoxStringViews removed; // Only in the old tree
+    FoxStringViews changed; // In both trees with different contents
+    FoxInterner strings;    // Owns the paths
+} FoxTreeDiff;
+
+typedef struct {
+    FoxThreadPool *pool; // NULL means the default pool
+    /// Files with the same size and mtime are assumed to be unchanged,
+    /// set this to compare their contents anyway (mtime only has a resolution of one second)
+    bool always_hash;
+} FoxTreeDiffOpt;
+
+/// Walks both trees in parallel, compares size and mtime first and only hashes the files when those are ambiguous
+/// Usage:
+///     FoxTreeDiff diff = {0};
+///     if (fox_fs_tree_diff("build.old", "build", &diff))
+///         fox_da_foreach(FoxStringView, path, &diff.changed) { puts(path->items); }
+///     fox_tree_diff_free(&diff);
+bool fox_fs_tree_diff_opt(const char *old_path, const char *new_path, FoxTreeDiff *diff, FoxTreeDiffOpt opt);
+#define fox_fs_tree_diff(old_path, new_path, diff, ...) fox_fs_tree_diff_opt((old_path), (new_path), (diff), (FoxTreeDiffOpt) {__VA_ARGS__})
+void fox_tree_diff_free(FoxTreeDiff *diff);
+
+/// Groups of identical regular files, every group has at least two paths (including the root path) sorted by name
+typedef struct {
+    FoxStringViews *items;
+    size_t size;
+    size_t capacity;
+    FoxInterner strings; // Owns the paths
+} FoxDuplicates;
+
+#ifndef FOX_DEDUP_PARTIAL_SIZE
+#    define FOX_DEDUP_PARTIAL_SIZE 4096 // Bytes hashed from the start of every file with a non-unique size
+#endif // FOX_DEDUP_PARTIAL_SIZE
+
+typedef struct {
+    FoxThreadPool *pool; // NULL means the default pool
+    size_t partial_size; // 0 means FOX_DEDUP_PARTIAL_SIZE
+} FoxDedupOpt;
+
+/// Finds identical files under path with a size -> partial hash -> full hash funnel,
+/// so only files that agree on size and on their first bytes are read entirely.
+/// Files are compared by hash, not byte by byte.
+bool fox_fs_find_duplicates_opt(const char *path, FoxDuplicates *dups, FoxDedupOpt opt);
+#define fox_fs_find_duplicates(path, dups, ...) fox_fs_find_duplicates_opt((path), (dups), (FoxDedupOpt) {__VA_ARGS__})
+void fox_duplicates_free(FoxDuplicates *dups);
+
 // Log utils
 
+// Numeric levels for the preprocessor
+#define FOX_LOG_LEVEL_TRACE 0
+#define FOX_LOG_LEVEL_DEBUG 1
+#define FOX_LOG_LEVEL_INFO 2
+#define FOX_LOG_LEVEL_WARNING 3
+#define FOX_LOG_LEVEL_ERROR 4
+#define FOX_LOG_LEVEL_CRITICAL 5
+#define FOX_LOG_LEVEL_NO_LOGS 6
+
+/// Logging below this level is compiled out, the arguments are not even evaluated.
+/// Example: -DFOX_LOG_ACTIVE_LEVEL=FOX_LOG_LEVEL_INFO removes the trace and debug logs
+#ifndef FOX_LOG_ACTIVE_LEVEL
+#    define FOX_LOG_ACTIVE_LEVEL FOX_LOG_LEVEL_TRACE
+#endif // FOX_LOG_ACTIVE_LEVEL
+
 typedef enum {
-    LOG_TRACE,
-    LOG_DEBUG,
-    LOG_INFO,
-    LOG_WARNING,
-    LOG_ERROR,
-    LOG_CRITICAL,
-    LOG_NO_LOGS,
+    LOG_TRACE = FOX_LOG_LEVEL_TRACE,
+    LOG_DEBUG = FOX_LOG_LEVEL_DEBUG,
+    LOG_INFO = FOX_LOG_LEVEL_INFO,
+    LOG_WARNING = FOX_LOG_LEVEL_WARNING,
+    LOG_ERROR = FOX_LOG_LEVEL_ERROR,
+    LOG_CRITICAL = FOX_LOG_LEVEL_CRITICAL,
+    LOG_NO_LOGS = FOX_LOG_LEVEL_NO_LOGS,
 } FoxLogLevel;
 
 struct FoxLogSink;
@@ -664,15 +1659,75 @@ typedef bool (*FoxLogHandlerFn)(struct FoxLogSink *sink, FoxStringBuf *buf, FoxL
                                 va_list args);
 typedef void (*FoxSinkWriteFn)(struct FoxLogSink *sink, FoxStringView sv);
 typedef void (*FoxSinkCloseFn)(struct FoxLogSink *sink);
+typedef void (*FoxSinkFlushFn)(struct FoxLogSink *sink);
+
+typedef enum {
+    FOX_PATTERN_LITERAL,
+    FOX_PATTERN_YEAR,        // %Y: 2024
+    FOX_PATTERN_MONTH,       // %m: 01-12
+    FOX_PATTERN_DAY,         // %d: 01-31
+    FOX_PATTERN_HOUR,        // %H: 00-23
+    FOX_PATTERN_MINUTE,      // %M: 00-59
+    FOX_PATTERN_SECOND,      // %S: 00-60
+    FOX_PATTERN_MILLIS,      // %e: 000-999
+    FOX_PATTERN_MICROS,      // %f: 000000-999999
+    FOX_PATTERN_NANOS,       // %F: 000000000-999999999
+    FOX_PATTERN_LEVEL,       // %l: INFO
+    FOX_PATTERN_SHORT_LEVEL, // %L: I
+    FOX_PATTERN_THREAD,      // %t: id of the calling thread
+    FOX_PATTERN_FILE,        // %s: name of the source file
+    FOX_PATTERN_PATH,        // %g: path of the source file, as given
+    FOX_PATTERN_LINE,        // %#: line of the source file
+    FOX_PATTERN_MESSAGE,     // %v: the formatted message
+    FOX_PATTERN_COLOR_BEGIN, // %^: start the colour of the level
+    FOX_PATTERN_COLOR_END,   // %$: end the colour of the level
+} FoxLogPatternOp;
+
+typedef struct {
+    FoxLogPatternOp op;
+    u32 offset; // Only for FOX_PATTERN_LITERAL, the text is in literals
+    u32 size;   // For the date and time flags, the number of items rendered together and cached once per second
+} FoxLogPatternItem;
+
+/// A pattern is compiled once into a sequence of operations,
+/// formatting a line does not parse the pattern again.
+/// The flags are like in spdlog and %% is a literal '%'.
+/// Every line ends with a newline.
+/// Zero-initialized value means that the handler uses FOX_LOG_DEFAULT_PATTERN.
+typedef struct {
+    FoxLogPatternItem *items;
+    size_t size;
+    size_t capacity;
+    FoxStringBuf literals;
+    u32 id; // Identifies the pattern in the timestamp cache
+    bool color;
+    bool has_time;
+} FoxLogPattern;
+
+#ifndef FOX_LOG_DEFAULT_PATTERN
+#    define FOX_LOG_DEFAULT_PATTERN "[%^%l%$] %v"
+#endif // FOX_LOG_DEFAULT_PATTERN
+
+/// INFO: The date and time up to the seconds is rendered once per second and thread,
+/// only the sub-second flags are rendered for every line.
+/// Define FOX_LOG_COARSE_CLOCK to read the time with CLOCK_REALTIME_COARSE where it is available.
+/// It is much cheaper to read, but only has a resolution of a few milliseconds.
+
+/// Returns false if @p str contains an unknown flag, @p pattern is left empty then
+bool fox_log_pattern_compile(FoxLogPattern *pattern, const char *str, bool color);
+void fox_log_pattern_format(const FoxLogPattern *pattern, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line,
+                            va_list args);
+void fox_log_pattern_free(FoxLogPattern *pattern);
 
 typedef struct FoxLogSink {
-    // TODO: add support for log patterns (like in spdlog)
     void *handle;
     FoxLogLevel min_level;
+    FoxLogPattern pattern; // Owned by the sink
 
     FoxLogHandlerFn log_handler;
     FoxSinkWriteFn sink_write;
     FoxSinkCloseFn sink_close;
+    FoxSinkFlushFn sink_flush;
 } FoxSink;
 
 typedef struct {
@@ -683,39 +1738,256 @@ typedef struct {
 
 typedef struct {
     FoxSinks sinks;
+    atomic_int min_level; // Checked before any work, the sinks can still filter on their own
 } FoxLogger;
 
-FoxSink fox_logger_file_sink(const char *path);
+#ifndef FOX_LOG_FILE_BUFFER_SIZE
+#    define FOX_LOG_FILE_BUFFER_SIZE (64 * 1024) // in bytes
+#endif // FOX_LOG_FILE_BUFFER_SIZE
+
+typedef struct {
+    size_t max_size;          // Rotate before the file grows beyond this size, 0 means no limit
+    u64 rotate_interval;      // Rotate when the file is older than this (in seconds), 0 means never
+    size_t max_files;         // Number of rotated files to keep as path.1 (newest) ... path.N, at least 1 when rotating
+    size_t buffer_size;       // Lines are buffered up to this size (FOX_LOG_FILE_BUFFER_SIZE by default)
+    u64 flush_interval;       // Flush on a write when the last flush is older than this (in milliseconds), 0 means never
+    bool append;              // Append to an existing file (O_APPEND) instead of truncating it
+    bool sync;                // Sync the data to the disk after every flush (fdatasync)
+} FoxFileSinkOpt;
+
+/// Buffers the lines and writes them to the file in batches. The buffer is written when
+/// it is full, on fox_logger_flush, on a LOG_ERROR or LOG_CRITICAL message, before
+/// FOX_PANIC (and the other aborting macros) and when the sink is closed.
+/// An idle sink keeps its buffer, set flush_interval to bound how old a buffered line can get
+/// while the process keeps logging.
+/// Rotation happens while flushing, wrap the sink in fox_logger_async_sink to keep
+/// both off the logging threads.
+/// Usage:
+///     FoxSink sink = fox_logger_file_sink("build.log", .max_size = 16 * 1024 * 1024, .max_files = 4);
+FoxSink fox_logger_file_sink_opt(const char *path, FoxFileSinkOpt opt);
+#define fox_logger_file_sink(path, ...) fox_logger_file_sink_opt((path), (FoxFileSinkOpt) {__VA_ARGS__})
+
+#ifndef FOX_LOG_SCRATCH_MAX
+#    define FOX_LOG_SCRATCH_MAX (16 * 1024) // Bigger per-thread log buffers are freed after use
+#endif // FOX_LOG_SCRATCH_MAX
+
+#ifndef FOX_ASYNC_LOG_CAPACITY
+#    define FOX_ASYNC_LOG_CAPACITY 1024 // in slots, must be a power of 2
+#endif // FOX_ASYNC_LOG_CAPACITY
+
+#ifndef FOX_ASYNC_LOG_SLOT_SIZE
+#    define FOX_ASYNC_LOG_SLOT_SIZE 128 // in bytes
+#endif // FOX_ASYNC_LOG_SLOT_SIZE
+
+#ifndef FOX_ASYNC_LOG_BATCH_SIZE
+#    define FOX_ASYNC_LOG_BATCH_SIZE (64 * 1024) // in bytes
+#endif // FOX_ASYNC_LOG_BATCH_SIZE
+
+typedef enum {
+    FOX_ASYNC_BLOCK,        // Wait for the writer thread to make space
+    FOX_ASYNC_DROP,         // Silently drop the message
+    FOX_ASYNC_DROP_COUNTED, // Drop the message and report the count in the log
+} FoxAsyncOverflow;
+
+typedef struct {
+    size_t capacity;  // Number of slots in the ring buffer (FOX_ASYNC_LOG_CAPACITY by default)
+    size_t slot_size; // Size of each slot, long messages span several slots (FOX_ASYNC_LOG_SLOT_SIZE by default)
+    FoxAsyncOverflow overflow;
+} FoxAsyncSinkOpt;
+
+/// Wraps @p inner so that the calling thread only formats the message and copies it into
+/// a ring buffer. A background thread drains the ring buffer and writes to @p inner in batches.
+/// The messages are flushed when a LOG_ERROR or LOG_CRITICAL message is logged, on fox_logger_flush
+/// and when the sink is closed. The async sink owns @p inner after this call.
+/// If the writer thread cannot be started, @p inner is returned as it is.
+/// Usage:
+///     FoxLogger logger = {0};
+///     fox_da_append(&logger.sinks, fox_logger_async_sink(fox_logger_file_sink("build.log"), .overflow = FOX_ASYNC_DROP_COUNTED));
+///     ...
+///     fox_logger_free(&logger); // Drains the pending messages
+///
+/// INFO: Define FOX_ASYNC_DEFAULT_LOG to make the default logger asynchronous
+FoxSink fox_logger_async_sink_opt(FoxSink inner, FoxAsyncSinkOpt opt);
+#define fox_logger_async_sink(inner, ...) fox_logger_async_sink_opt((inner), (FoxAsyncSinkOpt) {__VA_ARGS__})
+
+/// Binary logging defers the formatting of a message. fox_binary_log_handler
+/// only records the level, path, line, a timestamp, the pointer to the format string
+/// and the raw arguments. The message is formatted later when it is decoded.
+/// Combined with the async sink, the formatting happens on the writer thread:
+///     FoxSink text = fox_logger_file_sink("build.log");
+///     fox_da_append(&logger.sinks, fox_logger_async_sink(fox_logger_binary_sink(text)));
+///
+/// fox_logger_binary_file_sink writes self-contained records to a file that can be
+/// decoded later with fox_binary_log_decode:
+///     FoxStringBuf bytes = {0};
+///     fox_fs_read_entire_file("build.bin", &bytes);
+///     FoxStringView view = fox_sv(bytes);
+///     FoxBinaryLogEntry entry = {0};
+///     while (fox_binary_log_decode(&view, &entry))
+///         printf(SV_Fmt "\n", SV_Arg(entry.message));
+///     fox_sb_free(&entry.message);
+///
+/// INFO: The format string and the path must outlive the decoding of the record
+/// (string literals and __FILE__ always do). Records are in the native byte order,
+/// long double arguments are stored as double and wide strings are not supported.
+
+typedef struct {
+    FoxLogLevel level;
+    FoxStringView path;
+    size_t line;
+    u64 timestamp; // Nanoseconds since the epoch
+    FoxStringBuf message;
+} FoxBinaryLogEntry;
+
+bool fox_binary_log_handler(FoxSink *sink, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args);
+/// Decodes the first record of @p bytes into @p entry and removes it from @p bytes.
+/// Returns false if @p bytes is empty or does not start with a complete record.
+bool fox_binary_log_decode(FoxStringView *bytes, FoxBinaryLogEntry *entry);
+/// Formats binary records and passes them to the handler and writer of @p inner
+FoxSink fox_logger_binary_sink(FoxSink inner);
+FoxSink fox_logger_binary_file_sink(const char *path);
 
 void fox_logger_handler(FoxLogger *logger, FoxLogHandlerFn handler);
+/// Sets the minimum level of the logger and of every sink
 void fox_logger_min_level(FoxLogger *logger, FoxLogLevel level);
+/// A disabled level costs one relaxed atomic load, and nothing if it is below FOX_LOG_ACTIVE_LEVEL
+static inline bool fox_logger_enabled(FoxLogger *logger, FoxLogLevel level) {
+    return (int) level >= FOX_LOG_ACTIVE_LEVEL && logger != NULL && (int) level >= atomic_load_explicit(&logger->min_level, memory_order_relaxed);
+}
+/// Sets the pattern of every sink, returns false if @p pattern could not be compiled
+bool fox_logger_pattern(FoxLogger *logger, const char *pattern, bool color);
+bool fox_sink_pattern(FoxSink *sink, const char *pattern, bool color);
+void fox_logger_flush(FoxLogger *logger);
 void fox_logger_free(FoxLogger *logger);
 
 void fox_logger_vlog_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args);
 #define fox_logger_vlog(logger, level, fmt, args) fox_logger_vlog_ext((logger), (level), (fmt), __FILE__, __LINE__, (args))
 void fox_logger_log_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, ...);
-#define fox_logger_log(logger, level, fmt, ...) fox_logger_log_ext((logger), (level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_trace(logger, fmt, ...) fox_logger_log_ext((logger), LOG_TRACE, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_debug(logger, fmt, ...) fox_logger_log_ext((logger), LOG_DEBUG, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_info(logger, fmt, ...) fox_logger_log_ext((logger), LOG_INFO, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_warning(logger, fmt, ...) fox_logger_log_ext((logger), LOG_WARNING, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_error(logger, fmt, ...) fox_logger_log_ext((logger), LOG_ERROR, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_logger_log_critical(logger, fmt, ...) fox_logger_log_ext((logger), LOG_CRITICAL, (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
+/// The arguments are only evaluated if the level is enabled
+/// INFO: @p logger is evaluated twice
+#define fox_logger_log(logger, level, fmt, ...)                                                                                                      \
+    (fox_logger_enabled((logger), (level)) ? fox_logger_log_ext((logger), (level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__) : (void) 0)
+
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_TRACE
+#    define fox_logger_log_trace(logger, fmt, ...) fox_logger_log((logger), LOG_TRACE, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_trace(logger, fmt, ...) ((void) sizeof(logger))
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_DEBUG
+#    define fox_logger_log_debug(logger, fmt, ...) fox_logger_log((logger), LOG_DEBUG, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_debug(logger, fmt, ...) ((void) sizeof(logger))
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_INFO
+#    define fox_logger_log_info(logger, fmt, ...) fox_logger_log((logger), LOG_INFO, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_info(logger, fmt, ...) ((void) sizeof(logger))
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_WARNING
+#    define fox_logger_log_warning(logger, fmt, ...) fox_logger_log((logger), LOG_WARNING, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_warning(logger, fmt, ...) ((void) sizeof(logger))
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_ERROR
+#    define fox_logger_log_error(logger, fmt, ...) fox_logger_log((logger), LOG_ERROR, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_error(logger, fmt, ...) ((void) sizeof(logger))
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_CRITICAL
+#    define fox_logger_log_critical(logger, fmt, ...) fox_logger_log((logger), LOG_CRITICAL, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_logger_log_critical(logger, fmt, ...) ((void) sizeof(logger))
+#endif
 
 extern FoxLogger fox_default_logger;
+/// Sets up the sinks of fox_default_logger on first use
+FoxLogger *fox__default_logger__(void);
 bool fox_default_log_handler(FoxSink *sink, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args);
 void fox_default_log_write(FoxSink *sink, FoxStringView sv);
 
 void fox_vlog_ext(FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args);
 #define fox_vlog(level, fmt, args) fox_vlog_ext((level), (fmt), __FILE__, __LINE__, (args))
 void fox_log_ext(FoxLogLevel level, const char *fmt, const char *path, size_t line, ...);
-#define fox_log(level, fmt, ...) fox_log_ext((level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__)
-#define fox_log_trace(fmt, ...) fox_log(LOG_TRACE, (fmt), ##__VA_ARGS__)
-#define fox_log_debug(fmt, ...) fox_log(LOG_DEBUG, (fmt), ##__VA_ARGS__)
-#define fox_log_info(fmt, ...) fox_log(LOG_INFO, (fmt), ##__VA_ARGS__)
-#define fox_log_warning(fmt, ...) fox_log(LOG_WARNING, (fmt), ##__VA_ARGS__)
-#define fox_log_error(fmt, ...) fox_log(LOG_ERROR, (fmt), ##__VA_ARGS__)
-#define fox_log_critical(fmt, ...) fox_log(LOG_CRITICAL, (fmt), ##__VA_ARGS__)
+/// Guards expensive work that only feeds a log message
+/// Usage:
+///     if (fox_log_enabled(LOG_DEBUG)) {
+///         FoxStringBuf dump = dump_state(); // Only computed when it is logged
+///         fox_log_debug("state: %s", dump.items);
+///         fox_sb_free(&dump);
+///     }
+#define fox_log_enabled(level) fox_logger_enabled(&fox_default_logger, (level))
+/// The arguments are only evaluated if the level is enabled
+#define fox_log(level, fmt, ...) (fox_log_enabled(level) ? fox_log_ext((level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__) : (void) 0)
+
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_TRACE
+#    define fox_log_trace(fmt, ...) fox_log(LOG_TRACE, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_trace(fmt, ...) ((void) 0)
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_DEBUG
+#    define fox_log_debug(fmt, ...) fox_log(LOG_DEBUG, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_debug(fmt, ...) ((void) 0)
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_INFO
+#    define fox_log_info(fmt, ...) fox_log(LOG_INFO, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_info(fmt, ...) ((void) 0)
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_WARNING
+#    define fox_log_warning(fmt, ...) fox_log(LOG_WARNING, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_warning(fmt, ...) ((void) 0)
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_ERROR
+#    define fox_log_error(fmt, ...) fox_log(LOG_ERROR, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_error(fmt, ...) ((void) 0)
+#endif
+#if FOX_LOG_ACTIVE_LEVEL <= FOX_LOG_LEVEL_CRITICAL
+#    define fox_log_critical(fmt, ...) fox_log(LOG_CRITICAL, (fmt), ##__VA_ARGS__)
+#else
+#    define fox_log_critical(fmt, ...) ((void) 0)
+#endif
+
+/// Token bucket (implemented as GCRA) that allows @p rate messages per second on average
+/// and bursts of up to @p burst messages. It is a single atomic word, so it can live in a
+/// static slot of the call site and be shared by every thread without a lookup.
+typedef struct {
+    atomic_uint_least64_t tat; // Theoretical arrival time of the next message, in nanoseconds
+    atomic_size_t suppressed;
+} FoxLogLimiter;
+
+/// Returns true if a message may be logged now. When it does, @p suppressed receives
+/// the number of messages rejected since the last allowed one.
+bool fox_log_limiter_allow(FoxLogLimiter *limiter, double rate, size_t burst, size_t *suppressed);
+
+/// Logs at most @p rate messages per second from this call site (with bursts of @p burst).
+/// The count of suppressed messages is logged before the next message that goes through.
+/// Usage:
+///     fox_log_limited(LOG_ERROR, 10, 20, "Failed to remove: %s", path);
+#define fox_logger_log_limited(logger, level, rate, burst, fmt, ...)                                                                                 \
+    do {                                                                                                                                             \
+        static FoxLogLimiter fox__limiter__ = {0};                                                                                                   \
+        FoxLogger *fox__logger__ = (logger);                                                                                                         \
+        size_t fox__suppressed__ = 0;                                                                                                                \
+        if (fox_logger_enabled(fox__logger__, (level)) && fox_log_limiter_allow(&fox__limiter__, (rate), (burst), &fox__suppressed__)) {             \
+            if (fox__suppressed__ > 0)                                                                                                               \
+                fox_logger_log_ext(fox__logger__, (level), "%zu similar messages were suppressed", __FILE__, __LINE__, fox__suppressed__);           \
+            fox_logger_log_ext(fox__logger__, (level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__);                                                    \
+        }                                                                                                                                            \
+    } while (false)
+#define fox_log_limited(level, rate, burst, fmt, ...) fox_logger_log_limited(fox__default_logger__(), (level), (rate), (burst), (fmt), ##__VA_ARGS__)
+
+/// Logs the 1st, (n+1)th, (2n+1)th... message from this call site
+#define fox_logger_log_every_n(logger, level, n, fmt, ...)                                                                                           \
+    do {                                                                                                                                             \
+        static atomic_size_t fox__count__ = 0;                                                                                                       \
+        FoxLogger *fox__logger__ = (logger);                                                                                                         \
+        if (fox_logger_enabled(fox__logger__, (level)) && atomic_fetch_add_explicit(&fox__count__, 1, memory_order_relaxed) % (n) == 0)              \
+            fox_logger_log_ext(fox__logger__, (level), (fmt), __FILE__, __LINE__, ##__VA_ARGS__);                                                    \
+    } while (false)
+#define fox_log_every_n(level, n, fmt, ...) fox_logger_log_every_n(fox__default_logger__(), (level), (n), (fmt), ##__VA_ARGS__)
 
 // Filesystem utils
 
@@ -723,6 +1995,8 @@ bool fox_fs_read_entire_file(const char *path, FoxStringBuf *sb);
 bool fox_fs_write_entire_file(const char *path, FoxStringView sv);
 bool fox_fs_read_symlink(const char *path, FoxStringBuf *sb);
 bool fox_fs_read_entire_dir(const char *path, FoxStringBufs *files);
+/// Same as fox_fs_read_entire_dir, short paths are stored inline without a heap allocation
+bool fox_fs_read_entire_dir_ssb(const char *path, FoxSmallStringBufs *files);
 
 typedef enum {
     FOX_VISIT_CONT,
@@ -961,26 +2235,201 @@ bool fox__auto_build__(const char *src_file, int argc, char *argv[]);
 #define fox_auto_build(argc, argv) fox__auto_build__(__FILE__, argc, argv);
 
 u32 fox_nprocessors(void);
+/// Monotonic clock in nanoseconds, only meaningful for measuring durations
+u64 fox_time_ns(void);
 
-#endif // FOX_H_
+// Futures
 
-#ifdef FOX_IMPLEMENTATION
+/// The boolean result of an operation that runs on fox_default_thread_pool().
+/// Every future must be freed with fox_future_free, also when a continuation was attached to it.
+/// Usage:
+///     FoxFuture *read = fox_fs_read_entire_file_async("main.c", &source);
+///     FoxFuture *build = fox_cmd_run_async(&cmd);
+///     FoxFuture *hashed = fox_future_then(read, hash_source, &source);
+///     FoxFuture *all[] = {build, hashed};
+///     if (!fox_future_wait_all(all, 2, 10000)) { ... } // Timed out after 10 seconds
+typedef struct FoxFuture FoxFuture;
+
+typedef bool (*FoxFutureFn)(void *arg);
+/// @p ok is the result of the previous future
+typedef bool (*FoxFutureThenFn)(bool ok, void *arg);
+
+FoxFuture *fox_future_async(FoxFutureFn fn, void *arg);
+/// Runs @p fn after @p future completed, the returned future holds its result
+FoxFuture *fox_future_then(FoxFuture *future, FoxFutureThenFn fn, void *arg);
+bool fox_future_is_ready(FoxFuture *future);
+/// The future must be ready
+bool fox_future_result(FoxFuture *future);
+/// Blocks until the future is ready and returns its result
+bool fox_future_wait(FoxFuture *future);
+/// A negative @p timeout_ms waits forever, returns false on timeout
+bool fox_future_wait_timeout(FoxFuture *future, int timeout_ms);
+/// Returns false if some future is still not ready after @p timeout_ms
+bool fox_future_wait_all(FoxFuture **futures, size_t count, int timeout_ms);
+/// Returns the index of a ready future or @p count on timeout
+size_t fox_future_wait_any(FoxFuture **futures, size_t count, int timeout_ms);
+/// Waits for the future before freeing it
+void fox_future_free(FoxFuture *future);
+
+/// The command is copied, so @p cmd can be reused right away. The other pointers in @p opt
+/// (paths, env, exit_code) must stay valid until the future is ready.
+FoxFuture *fox_cmd_run_async_opt(FoxCmd *cmd, FoxCmdOpt opt);
+#define fox_cmd_run_async(cmd, ...) fox_cmd_run_async_opt((cmd), (FoxCmdOpt) {.reset = true, __VA_ARGS__})
+/// @p sb must stay valid and untouched until the future is ready
+FoxFuture *fox_fs_read_entire_file_async(const char *path, FoxStringBuf *sb);
+FoxFuture *fox_fs_copy_file_async(const char *from, const char *to, FoxCopyOptions options);
+
+// Benchmarking
+
+#ifndef FOX_BENCH_SAMPLES
+#    define FOX_BENCH_SAMPLES 21
+#endif // FOX_BENCH_SAMPLES
+
+#ifndef FOX_BENCH_SAMPLE_NS
+#    define FOX_BENCH_SAMPLE_NS 10000000 // The iteration count is calibrated until one sample takes this long
+#endif // FOX_BENCH_SAMPLE_NS
+
+#ifndef FOX_BENCH_WARMUP_NS
+#    define FOX_BENCH_WARMUP_NS 100000000
+#endif // FOX_BENCH_WARMUP_NS
 
-#if defined(FOX_OS_LINUX)
-#    include <asm/termbits.h>
-#    include <dirent.h>
-#    include <fcntl.h>
-#    include <poll.h>
-#    include <sys/ioctl.h>
-#    include <sys/stat.h>
-#    include <sys/statvfs.h>
-#    include <sys/sysinfo.h>
-#    include <sys/time.h>
-#    include <sys/wait.h>
-#    include <unistd.h>
-#elif defined(FOX_OS_WINDOWS)
+typedef struct {
+    size_t iterations; // Set by the harness, the benchmark runs its body this many times
+    u64 bytes;         // Bytes processed by one iteration, set by the benchmark to report throughput
+    void *user;
+} FoxBench;
+
+/// Usage:
+///     void bench_split(FoxBench *bench) {
+///         bench->bytes = line.size;
+///         for (size_t i = 0; i < bench->iterations; i++) {
+///             FoxStringViews parts = fox_str_split(line, ' ');
+///             fox_do_not_optimize(&parts);
+///             fox_da_free(&parts);
+///         }
+///     }
+///     fox_bench_register("str/split", bench_split, NULL);
+///     return fox_bench_main(argc, argv);
+typedef void (*FoxBenchFn)(FoxBench *bench);
+
+/// All times are per iteration
+typedef struct {
+    const char *name;
+    size_t iterations; // Per sample
+    size_t samples;
+    double median_ns;
+    double p99_ns;
+    double mad_ns; // Median absolute deviation
+    double min_ns;
+    double bytes_per_sec; // 0 if the benchmark did not set bytes
+    double allocs;        // Blocks allocated or grown through fox_realloc, only measured with FOX_TRACK_ALLOCS
+} FoxBenchResult;
+
+typedef struct {
+    const char *filter;    // Only run benchmarks whose name contains this
+    const char *json_path; // Also write the results as JSON here
+    size_t samples;        // FOX_BENCH_SAMPLES by default
+    u64 sample_ns;         // FOX_BENCH_SAMPLE_NS by default
+    u64 warmup_ns;         // FOX_BENCH_WARMUP_NS by default
+} FoxBenchOpt;
+
+void fox_bench_register(const char *name, FoxBenchFn fn, void *user);
+/// Runs every registered benchmark and prints a table to stdout
+bool fox_bench_run_all_opt(FoxBenchOpt opt);
+#define fox_bench_run_all(...) fox_bench_run_all_opt((FoxBenchOpt) {__VA_ARGS__})
+/// Parses `[filter] [--json path]` from the command line and runs the benchmarks
+int fox_bench_main(int argc, char *argv[]);
+
+/// Keeps the compiler from optimizing away the computation that produced `*p`
+#if defined(__GNUC__) || defined(__clang__)
+#    define fox_do_not_optimize(p) __asm__ volatile("" : : "g"(p) : "memory")
+#else
+extern const void *volatile fox__bench_sink__;
+#    define fox_do_not_optimize(p) (fox__bench_sink__ = (p))
+#endif
+
+// Profiling
+
+/// Define FOX_PROFILE to measure the scopes marked with FOX_ZONE("name"), fox's own hot paths are marked already.
+/// Without FOX_PROFILE every zone compiles to nothing.
+/// Each thread aggregates its zones in its own buffer (calls, total and self time, a log2 histogram),
+/// so entering and leaving a zone only reads the cycle counter and touches thread local memory.
+/// When a thread exits, its buffer is folded into a shared total and freed.
+/// The report is printed to stderr at exit, or with fox_profile_report.
+/// Usage:
+///     void compile_all(void) {
+///         FOX_ZONE("compile_all");
+///         ...
+///     }
+#ifdef FOX_PROFILE
+
+#    ifndef FOX_PROFILE_MAX_ZONES
+#        define FOX_PROFILE_MAX_ZONES 256
+#    endif // FOX_PROFILE_MAX_ZONES
+
+#    ifndef FOX_PROFILE_MAX_DEPTH
+#        define FOX_PROFILE_MAX_DEPTH 64
+#    endif // FOX_PROFILE_MAX_DEPTH
+
+typedef struct {
+    const char *name;
+    const char *file;
+    u32 line;
+    atomic_uint id; // 0 until the zone is entered for the first time
+} FoxZoneSite;
+
+typedef struct {
+    u64 start;
+    u32 id;
+} FoxZone;
+
+FoxZone fox__zone_begin__(FoxZoneSite *site);
+void fox__zone_end__(FoxZone *zone);
+
+#    define FOX__ZONE_CONCAT2__(a, b) a##b
+#    define FOX__ZONE_CONCAT__(a, b) FOX__ZONE_CONCAT2__(a, b)
+#    if defined(__GNUC__) || defined(__clang__)
+#        define FOX_ZONE(name)                                                                                                                       \
+            static FoxZoneSite FOX__ZONE_CONCAT__(fox__zone_site_, __LINE__) = {(name), __FILE__, __LINE__, 0};                                      \
+            FoxZone FOX__ZONE_CONCAT__(fox__zone_, __LINE__) __attribute__((cleanup(fox__zone_end__))) =                                             \
+                    fox__zone_begin__(&FOX__ZONE_CONCAT__(fox__zone_site_, __LINE__))
+#    else
+// The zone ends with the scope, which needs the cleanup attribute
+#        define FOX_ZONE(name) ((void) 0)
+#    endif
+
+/// Prints one line per zone, sorted by self time. Other threads should not be inside a zone meanwhile.
+void fox_profile_report(FILE *out);
+void fox_profile_reset(void);
+
+#else
+#    define FOX_ZONE(name) ((void) 0)
+#    define fox_profile_report(out) ((void) (out))
+#    define fox_profile_reset() ((void) 0)
+#endif // FOX_PROFILE
+
+#endif // FOX_H_
+
+#ifdef FOX_IMPLEMENTATION
+
+#if defined(FOX_OS_LINUX)
+#    include <asm/termbits.h>
+#    include <dirent.h>
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <sys/ioctl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <sys/statvfs.h>
+#    include <sys/syscall.h>
+#    include <sys/sysinfo.h>
+#    include <sys/time.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
+#elif defined(FOX_OS_WINDOWS)
 #    define WIN32_LEAN_AND_MEAN
 #    include <Shlwapi.h>
+#    include <io.h>
 #    include <windows.h>
 #    include <winioctl.h>
 #endif
@@ -1003,7 +2452,24 @@ typedef HANDLE FoxFd;
 #endif
 
 
+static bool fox__arena_owns__(const FoxArena *arena, const void *p);
+static thread_local FoxArena *fox__arena_scope__ = NULL;
+
+#ifdef FOX_TRACK_ALLOCS
+// New blocks are not tracked while paused, blocks that are tracked already still are
+static thread_local int fox__allocs_paused__ = 0;
+#    define FOX__ALLOCS_PAUSE__() (fox__allocs_paused__++)
+#    define FOX__ALLOCS_RESUME__() (fox__allocs_paused__--)
+#else
+#    define FOX__ALLOCS_PAUSE__() ((void) 0)
+#    define FOX__ALLOCS_RESUME__() ((void) 0)
+#endif // FOX_TRACK_ALLOCS
+
 void *fox__realloc__(void *p, size_t size) {
+    // Route to the arena bound to this thread, if p belongs to it
+    FoxArena *arena = fox__arena_scope__;
+    if (arena && (p == NULL || fox__arena_owns__(arena, p)))
+        return fox_arena_realloc(arena, p, size);
     // If p == NULL and size > 0 then return malloc(size)
     // If p == NULL and size == 0 then return NULL
     // If size == 0 then free(p)
@@ -1015,6 +2481,25 @@ void *fox__realloc__(void *p, size_t size) {
         return realloc(p, size);
 }
 
+size_t fox__da_grow_capacity__(size_t capacity, size_t required, size_t item_size) {
+    const size_t max_cap = SIZE_MAX / item_size;
+    FOX_ASSERT(required <= max_cap, "dynamic array capacity overflow");
+
+    if (capacity == 0)
+        capacity = FOX_ARRAY_INITIAL_CAP;
+    else {
+        // Grow geometrically, saturating instead of overflowing
+        double grown = (double) capacity * (FOX_ARRAY_GROWTH_FACTOR);
+        capacity = grown >= (double) max_cap ? max_cap : (size_t) grown;
+    }
+    if (capacity > max_cap)
+        capacity = max_cap;
+    // Jump straight to the required capacity if one step is not enough
+    if (capacity < required)
+        capacity = required;
+    return capacity;
+}
+
 void fox__rotate_left__(void *v_data, size_t item_size, size_t items_count, size_t n) {
     if (!v_data)
         return;
@@ -1220,6 +2705,8 @@ FoxStringView fox__str_trim_right__(FoxStringView str) {
 
 FoxStringView fox__str_trim__(FoxStringView str) { return fox__str_trim_right__(fox__str_trim_left__(str)); }
 
+u64 fox__str_hash__(FoxStringView str) { return fox_hash_bytes(str.items, str.size, 0); }
+
 FoxStringBuf fox_sb_from_chars(const char *data, size_t count) {
     FoxStringBuf sb = {0};
     fox_da_reserve(&sb, count + 1);
@@ -1268,6 +2755,17 @@ FoxStringBuf fox_sb_clone(const FoxStringBuf *sb) {
     return result;
 }
 
+void fox_sb_shrink_to_fit(FoxStringBuf *sb) {
+    if (sb->size == 0) {
+        fox_sb_free(sb);
+        return;
+    }
+    // Keep the null character
+    sb->size += 1;
+    fox_da_shrink_to_fit(sb);
+    sb->size -= 1;
+}
+
 void fox_sb_free(FoxStringBuf *sb) {
     // Aha! got ya, sb is a valid dynarray
     fox_da_free(sb);
@@ -1291,21 +2789,31 @@ void fox_sb_appendf(FoxStringBuf *sb, const char *fmt, ...) {
 }
 
 void fox_sb_vappendf(FoxStringBuf *sb, const char *fmt, va_list args) {
-    va_list args_for_size_computation;
-    va_copy(args_for_size_computation, args);
-    int n = vsnprintf(NULL, 0, fmt, args_for_size_computation);
-    va_end(args_for_size_computation);
-    if (n == -1)
+    FOX_ZONE("fox_sb_vappendf");
+    // The arguments may point into sb itself, so never format into sb directly.
+    // Short results take a single pass through a stack buffer.
+    char small[256];
+    va_list args_for_small;
+    va_copy(args_for_small, args);
+    int n = vsnprintf(small, sizeof(small), fmt, args_for_small);
+    va_end(args_for_small);
+    if (n < 0)
         FOX_PANIC("vsnprintf failed");
 
-    FoxStringBuf tmp = fox_sb_clone(sb);
-    fox_da_reserve(&tmp, tmp.size + n + 1);
-    vsnprintf(&tmp.items[tmp.size], n + 1, fmt, args);
-    tmp.size += n;
-    tmp.items[tmp.size] = '\0';
-    fox_sb_copy(sb, fox_sv(tmp));
-
-    fox_sb_free(&tmp);
+    if ((size_t) n < sizeof(small)) {
+        fox_da_reserve(sb, sb->size + (size_t) n + 1);
+        fox_da_append_many(sb, small, (size_t) n);
+    } else {
+        // Through fox_realloc, so that custom allocators, arena scopes and FOX_TRACK_ALLOCS see it
+        FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+        char *large = fox__realloc_site__(NULL, (size_t) n + 1);
+        FOX_ASSERT(large != NULL, "realloc failed");
+        vsnprintf(large, (size_t) n + 1, fmt, args);
+        fox_da_reserve(sb, sb->size + (size_t) n + 1);
+        fox_da_append_many(sb, large, (size_t) n);
+        fox__realloc_site__(large, 0);
+    }
+    fox_sb_append_null(sb);
 }
 
 void fox_sb_concat_sb(FoxStringBuf *sb, const FoxStringBuf *other) {
@@ -1432,153 +2940,3627 @@ FoxStringView fox_sv_from_sb(const FoxStringBuf sb) {
 
 FoxStringView fox_sv_from_sv(FoxStringView sv) { return sv; }
 
-FoxStringView fox_get_error_message(void) {
-#ifdef FOX_OS_LINUX
-    return fox_sv(strerror(errno));
-#elif defined(FOX_OS_WINDOWS)
-    thread_local static char err_msg_buf[4096];
-    DWORD size = FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), 0, err_msg_buf,
-                               FOX_ARRLEN(err_msg_buf), NULL);
-    if (size == 0)
-        fox_get_error_message();
-    return fox_sv(err_msg_buf);
+FoxStringView fox_sv_from_ssb(const FoxSmallStringBuf *ssb) {
+    return (FoxStringView) {
+            .items = fox_ssb_data(ssb),
+            .size = fox_ssb_size(ssb),
+    };
+}
+
+// The tag has to land in the top bit of the last byte of the union
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#    define fox__ssb_tag__(capacity) (((capacity) << 8) | 0x80)
+#    define fox__ssb_capacity__(ssb) ((ssb)->heap.capacity >> 8)
 #else
-#    error "Implement this"
+#    define FOX__SSB_HEAP__ ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+#    define fox__ssb_tag__(capacity) ((capacity) | FOX__SSB_HEAP__)
+#    define fox__ssb_capacity__(ssb) ((ssb)->heap.capacity & ~FOX__SSB_HEAP__)
 #endif
+
+size_t fox_ssb_size(const FoxSmallStringBuf *ssb) {
+    if (fox__ssb_is_heap__(ssb))
+        return ssb->heap.size;
+    return (unsigned char) ssb->small[sizeof(FoxSmallStringBuf) - 1];
 }
 
-static void fox__file_sink_close__(FoxSink *sink) {
-    FILE *file = sink->handle;
-    fclose(file);
+static void fox__ssb_set_size__(FoxSmallStringBuf *ssb, size_t size) {
+    if (fox__ssb_is_heap__(ssb))
+        ssb->heap.size = size;
+    else
+        ssb->small[sizeof(FoxSmallStringBuf) - 1] = (char) size;
+    fox_ssb_data(ssb)[size] = '\0';
 }
 
-FoxSink fox_logger_file_sink(const char *path) {
-    FILE *file = fopen(path, "wb");
-    if (file == NULL)
-        return (FoxSink) {0};
-    return (FoxSink) {
-            .handle = file,
-            .log_handler = fox_default_log_handler,
-            .sink_write = fox_default_log_write,
-            .sink_close = fox__file_sink_close__,
-    };
+FoxSmallStringBuf fox_ssb_from_chars(const char *data, size_t count) {
+    FoxSmallStringBuf ssb = {0};
+    if (count == 0)
+        return ssb;
+
+    fox_ssb_reserve(&ssb, count);
+    memcpy(fox_ssb_data(&ssb), data, count);
+    fox__ssb_set_size__(&ssb, count);
+    return ssb;
 }
 
-void fox_logger_handler(FoxLogger *logger, FoxLogHandlerFn handler) {
-    if (!logger)
-        return;
-    fox_da_foreach(FoxSink, sink, &logger->sinks) sink->log_handler = handler;
+FoxSmallStringBuf fox_ssb_from_cstr(const char *str) {
+    if (str == NULL)
+        return (FoxSmallStringBuf) {0};
+    return fox_ssb_from_chars(str, strlen(str));
 }
 
-void fox_logger_min_level(FoxLogger *logger, FoxLogLevel level) {
-    if (!logger)
+FoxSmallStringBuf fox_ssb_from_sv(FoxStringView sv) { return fox_ssb_from_chars(sv.items, sv.size); }
+
+void fox_ssb_reserve(FoxSmallStringBuf *ssb, size_t count) {
+    bool heap = fox__ssb_is_heap__(ssb);
+    // Still fits inline (with the null character)
+    if (!heap && count <= FOX_SSO_CAPACITY)
         return;
-    fox_da_foreach(FoxSink, sink, &logger->sinks) sink->min_level = level;
+
+    // Borrow the heap part as a StringBuf so that it grows like every other dynarray
+    size_t size = fox_ssb_size(ssb);
+    FoxStringBuf sb = {0};
+    if (heap)
+        sb = (FoxStringBuf) {.items = ssb->heap.items, .size = size, .capacity = fox__ssb_capacity__(ssb)};
+    fox_da_reserve(&sb, count + 1);
+    // Spill the inline contents to the heap
+    if (!heap)
+        memcpy(sb.items, ssb->small, size + 1);
+    ssb->heap.items = sb.items;
+    ssb->heap.size = size;
+    ssb->heap.capacity = fox__ssb_tag__(sb.capacity);
 }
 
-void fox_logger_free(FoxLogger *logger) {
-    if (!logger)
+void fox_ssb_clear(FoxSmallStringBuf *ssb) { fox__ssb_set_size__(ssb, 0); }
+
+void fox_ssb_free(FoxSmallStringBuf *ssb) {
+    if (fox__ssb_is_heap__(ssb)) {
+        FoxStringBuf sb = {
+                .items = ssb->heap.items,
+                .size = ssb->heap.size,
+                .capacity = fox__ssb_capacity__(ssb),
+        };
+        fox_sb_free(&sb);
+    }
+    *ssb = (FoxSmallStringBuf) {0};
+}
+
+void fox_ssb_concat_sv(FoxSmallStringBuf *ssb, FoxStringView other) {
+    if (other.size == 0)
         return;
-    fox_da_foreach(FoxSink, sink, &logger->sinks) {
-        if (sink->sink_close)
-            sink->sink_close(sink->handle);
+    size_t size = fox_ssb_size(ssb);
+    fox_ssb_reserve(ssb, size + other.size);
+    memmove(&fox_ssb_data(ssb)[size], other.items, other.size);
+    fox__ssb_set_size__(ssb, size + other.size);
+}
+
+void fox_ssb_appendf(FoxSmallStringBuf *ssb, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fox_ssb_vappendf(ssb, fmt, args);
+    va_end(args);
+}
+
+void fox_ssb_vappendf(FoxSmallStringBuf *ssb, const char *fmt, va_list args) {
+    va_list args_for_size_computation;
+    va_copy(args_for_size_computation, args);
+    int n = vsnprintf(NULL, 0, fmt, args_for_size_computation);
+    va_end(args_for_size_computation);
+    if (n == -1)
+        FOX_PANIC("vsnprintf failed");
+
+    size_t size = fox_ssb_size(ssb);
+    fox_ssb_reserve(ssb, size + n);
+    vsnprintf(&fox_ssb_data(ssb)[size], n + 1, fmt, args);
+    fox__ssb_set_size__(ssb, size + n);
+}
+
+FoxStringBuf fox_ssb_to_sb(FoxSmallStringBuf *ssb) {
+    FoxStringBuf sb = {0};
+    if (fox__ssb_is_heap__(ssb)) {
+        sb.items = ssb->heap.items;
+        sb.size = ssb->heap.size;
+        sb.capacity = fox__ssb_capacity__(ssb);
+    } else
+        sb = fox_sb_from_chars(ssb->small, fox_ssb_size(ssb));
+    *ssb = (FoxSmallStringBuf) {0};
+    return sb;
+}
+
+static u32 fox__hm_hash__(FoxStringView key) {
+    // 0 marks an empty slot
+    u32 hash = (u32) fox__str_hash__(key);
+    return hash == 0 ? 1 : hash;
+}
+
+static bool fox__hm_key_equals__(const void *item, FoxStringView key) {
+    // The key is always the first member of an entry
+    FoxStringView item_key;
+    memcpy(&item_key, item, sizeof(item_key));
+    return fox__str_equals__(item_key, key);
+}
+
+size_t fox__hm_skip__(const u32 *hashes, size_t capacity, size_t index) {
+    while (index < capacity && hashes[index] == 0)
+        index++;
+    return index;
+}
+
+size_t fox__hm_find__(const void *items, const u32 *hashes, size_t capacity, size_t item_size, FoxStringView key) {
+    if (capacity == 0)
+        return capacity;
+
+    const u8 *bytes = items;
+    const size_t mask = capacity - 1;
+    const u32 hash = fox__hm_hash__(key);
+    size_t index = hash & mask;
+    for (size_t dist = 0;; dist++) {
+        u32 slot_hash = hashes[index];
+        if (slot_hash == 0)
+            return capacity;
+        // Robin Hood invariant: the key would have been placed before a richer entry
+        if (((index - (slot_hash & mask)) & mask) < dist)
+            return capacity;
+        if (slot_hash == hash && fox__hm_key_equals__(&bytes[index * item_size], key))
+            return index;
+        index = (index + 1) & mask;
     }
-    fox_da_free(&logger->sinks);
 }
 
-void fox_logger_vlog_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args) {
-    if (!logger)
+size_t fox__hm_insert__(void *items, u32 *hashes, size_t capacity, size_t item_size, size_t *size, FoxStringView key) {
+    FOX_ASSERT(*size < capacity, "hash map is full");
+
+    u8 *bytes = items;
+    const size_t mask = capacity - 1;
+    const u32 hash = fox__hm_hash__(key);
+    size_t index = hash & mask;
+    for (size_t dist = 0;; dist++) {
+        u32 slot_hash = hashes[index];
+        if (slot_hash == 0)
+            break;
+        if (slot_hash == hash && fox__hm_key_equals__(&bytes[index * item_size], key))
+            return index;
+        // Take the place of the first entry that is closer to its home than we are
+        if (((index - (slot_hash & mask)) & mask) < dist) {
+            // Shift the rest of the cluster forward by one slot
+            size_t empty = index;
+            while (hashes[empty] != 0)
+                empty = (empty + 1) & mask;
+            while (empty != index) {
+                size_t prev = (empty - 1) & mask;
+                hashes[empty] = hashes[prev];
+                memcpy(&bytes[empty * item_size], &bytes[prev * item_size], item_size);
+                empty = prev;
+            }
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+
+    hashes[index] = hash;
+    memset(&bytes[index * item_size], 0, item_size);
+    memcpy(&bytes[index * item_size], &key, sizeof(key));
+    *size += 1;
+    return index;
+}
+
+bool fox__hm_remove__(void *items, u32 *hashes, size_t capacity, size_t item_size, size_t *size, FoxStringView key) {
+    size_t index = fox__hm_find__(items, hashes, capacity, item_size, key);
+    if (index == capacity)
+        return false;
+
+    // Shift the following entries back until one is at its home (or the slot is empty)
+    u8 *bytes = items;
+    const size_t mask = capacity - 1;
+    for (;;) {
+        size_t next = (index + 1) & mask;
+        u32 next_hash = hashes[next];
+        if (next_hash == 0 || (next_hash & mask) == next)
+            break;
+        hashes[index] = next_hash;
+        memcpy(&bytes[index * item_size], &bytes[next * item_size], item_size);
+        index = next;
+    }
+    hashes[index] = 0;
+    *size -= 1;
+    return true;
+}
+
+void fox__hm_rehash__(void **items, u32 **hashes, size_t *capacity, size_t item_size, size_t size, size_t new_cap) {
+    if (new_cap < size)
+        new_cap = size;
+
+    // Find the smallest power of 2 that keeps the load factor in check
+    size_t cap = FOX_HASHMAP_INITIAL_CAP;
+    while (new_cap * 100 > cap * FOX_HASHMAP_MAX_LOAD) {
+        FOX_ASSERT(cap <= SIZE_MAX / 2 / item_size, "hash map capacity overflow");
+        cap *= 2;
+    }
+    if (cap == *capacity)
         return;
 
-    FoxStringBuf buf = {0};
-    fox_da_foreach(FoxSink, sink, &logger->sinks) {
-        bool will_write = false;
-        if (sink->log_handler) {
-            va_list sink_args;
-            va_copy(sink_args, args);
-            will_write = sink->log_handler(sink, &buf, level, fmt, path, line, sink_args);
-            va_end(sink_args);
+    FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+    void *new_items = fox__realloc_site__(NULL, cap * item_size);
+    u32 *new_hashes = fox__realloc_site__(NULL, cap * sizeof(u32));
+    FOX_ASSERT(new_items != NULL && new_hashes != NULL, "realloc failed");
+    memset(new_hashes, 0, cap * sizeof(u32));
+
+    // Move every entry over to the new storage
+    size_t new_size = 0;
+    const u8 *old_bytes = *items;
+    for (size_t i = 0; i < *capacity; i++) {
+        if ((*hashes)[i] == 0)
+            continue;
+        FoxStringView key;
+        memcpy(&key, &old_bytes[i * item_size], sizeof(key));
+        size_t index = fox__hm_insert__(new_items, new_hashes, cap, item_size, &new_size, key);
+        memcpy((u8 *) new_items + index * item_size, &old_bytes[i * item_size], item_size);
+    }
+
+    fox__realloc_site__(*items, 0);
+    fox__realloc_site__(*hashes, 0);
+    *items = new_items;
+    *hashes = new_hashes;
+    *capacity = cap;
+}
+
+typedef struct FoxInternChunk {
+    struct FoxInternChunk *next;
+    size_t size;
+    size_t capacity;
+    char data[];
+} FoxInternChunk;
+
+static const char *fox__intern_store__(FoxInternShard *shard, FoxStringView sv) {
+    // Strings are stored with their null character
+    FoxInternChunk *chunk = shard->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->size < sv.size + 1) {
+        size_t capacity = sv.size + 1 > FOX_INTERNER_CHUNK_SIZE ? sv.size + 1 : FOX_INTERNER_CHUNK_SIZE;
+        FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+        FoxInternChunk *new_chunk = fox__realloc_site__(NULL, sizeof(FoxInternChunk) + capacity);
+        FOX_ASSERT(new_chunk != NULL, "realloc failed");
+        new_chunk->size = 0;
+        new_chunk->capacity = capacity;
+        // Keep the chunk with more free space in the front
+        if (chunk && chunk->capacity - chunk->size > capacity - (sv.size + 1)) {
+            new_chunk->next = chunk->next;
+            chunk->next = new_chunk;
+        } else {
+            new_chunk->next = chunk;
+            shard->chunks = new_chunk;
         }
-        if (sink->sink_write && will_write)
-            sink->sink_write(sink, fox_sv(buf));
+        chunk = new_chunk;
+    }
 
-        fox_da_clear(&buf);
+    char *str = &chunk->data[chunk->size];
+    memcpy(str, sv.items, sv.size);
+    str[sv.size] = '\0';
+    chunk->size += sv.size + 1;
+    return str;
+}
+
+static void fox__intern_grow__(FoxInternShard *shard) {
+    size_t new_cap = shard->capacity == 0 ? FOX_INTERNER_INITIAL_CAP : shard->capacity * 2;
+    FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+    FoxInternSlot *new_slots = fox__realloc_site__(NULL, new_cap * sizeof(FoxInternSlot));
+    FOX_ASSERT(new_slots != NULL, "realloc failed");
+    memset(new_slots, 0, new_cap * sizeof(FoxInternSlot));
+    // Rehash the old slots
+    for (size_t i = 0; i < shard->capacity; i++) {
+        FoxInternSlot slot = shard->slots[i];
+        if (slot.sv.items == NULL)
+            continue;
+        size_t index = slot.hash & (new_cap - 1);
+        while (new_slots[index].sv.items != NULL)
+            index = (index + 1) & (new_cap - 1);
+        new_slots[index] = slot;
     }
-    fox_sb_free(&buf);
+    fox__realloc_site__(shard->slots, 0);
+    shard->slots = new_slots;
+    shard->capacity = new_cap;
 }
 
-void fox_logger_log_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, ...) {
-    va_list args;
-    va_start(args, line);
-    fox_logger_vlog_ext(logger, level, fmt, path, line, args);
-    va_end(args);
+static FoxStringView fox__intern_shard__(FoxInternShard *shard, FoxStringView sv, u64 hash) {
+    // Keep the load factor under 3/4
+    if ((shard->size + 1) * 4 > shard->capacity * 3)
+        fox__intern_grow__(shard);
+
+    // Linear probing
+    size_t index = hash & (shard->capacity - 1);
+    for (;;) {
+        FoxInternSlot *slot = &shard->slots[index];
+        if (slot->sv.items == NULL)
+            break;
+        if (slot->hash == hash && fox__str_equals__(slot->sv, sv))
+            return slot->sv;
+        index = (index + 1) & (shard->capacity - 1);
+    }
+
+    FoxInternSlot *slot = &shard->slots[index];
+    slot->sv = fox_sv_from_raw(fox__intern_store__(shard, sv), sv.size);
+    slot->hash = hash;
+    shard->size++;
+    return slot->sv;
 }
 
-FoxLogger fox_default_logger = {0};
-static bool fox__def_log_init__ = false;
-static mtx_t fox__def_log_mtx__;
+static void fox__intern_shard_free__(FoxInternShard *shard) {
+    FoxInternChunk *chunk = shard->chunks;
+    while (chunk) {
+        FoxInternChunk *next = chunk->next;
+        fox__realloc_site__(chunk, 0);
+        chunk = next;
+    }
+    fox__realloc_site__(shard->slots, 0);
+    shard->slots = NULL;
+    shard->chunks = NULL;
+    shard->size = shard->capacity = 0;
+}
 
-static void fox__free_def_log__(void) { fox_logger_free(&fox_default_logger); }
+bool fox_interner_init_opt(FoxInterner *interner, FoxInternerOpt opt) {
+    if (!interner)
+        return false;
 
-static void fox__init_def_log__(void) {
-    if (!fox__def_log_init__) {
-        FoxSink default_sink = {
-                .handle = stderr,
-                .log_handler = fox_default_log_handler,
-                .sink_write = fox_default_log_write,
-                .sink_close = NULL,
-        };
-        fox_da_append(&fox_default_logger.sinks, default_sink);
-        if (mtx_init(&fox__def_log_mtx__, mtx_plain) == thrd_error) {
-            perror("could not initialize mutex for fox_default_logger");
-            abort();
+    *interner = (FoxInterner) {0};
+    if (opt.shards == 0)
+        return true;
+
+    // Round up to a power of 2 so that the shard can be picked with a mask
+    size_t shard_count = 1;
+    while (shard_count < opt.shards)
+        shard_count *= 2;
+
+    FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+    // Interned strings live until fox_interner_free, not until the end of an arena scope
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    interner->shards = fox__realloc_site__(NULL, shard_count * sizeof(FoxInternShard));
+    fox_arena_scope_end(prev_arena);
+    FOX_ASSERT(interner->shards != NULL, "realloc failed");
+    for (size_t i = 0; i < shard_count; i++) {
+        interner->shards[i] = (FoxInternShard) {0};
+        if (mtx_init(&interner->shards[i].mtx, mtx_plain) == thrd_error) {
+            for (size_t j = 0; j < i; j++)
+                mtx_destroy(&interner->shards[j].mtx);
+            fox__realloc_site__(interner->shards, 0);
+            interner->shards = NULL;
+            return false;
+        }
+    }
+    interner->shard_count = shard_count;
+    return true;
+}
+
+void fox_interner_free(FoxInterner *interner) {
+    if (!interner)
+        return;
+
+    fox__intern_shard_free__(&interner->local);
+    for (size_t i = 0; i < interner->shard_count; i++) {
+        fox__intern_shard_free__(&interner->shards[i]);
+        mtx_destroy(&interner->shards[i].mtx);
+    }
+    if (interner->shards)
+        fox__realloc_site__(interner->shards, 0);
+    *interner = (FoxInterner) {0};
+}
+
+FoxStringView fox_intern_sv(FoxInterner *interner, FoxStringView sv) {
+    if (!interner)
+        return (FoxStringView) {0};
+    // All empty strings share the same storage
+    if (sv.size == 0)
+        return fox_sv_from_raw("", 0);
+
+    u64 hash = fox__str_hash__(sv);
+    // The chunks and slots live until fox_interner_free, not until the end of an arena scope
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    FoxStringView result;
+    if (interner->shard_count == 0) {
+        result = fox__intern_shard__(&interner->local, sv, hash);
+    } else {
+        // Use the high bits for the shard, the low bits are used for probing
+        FoxInternShard *shard = &interner->shards[(hash >> 48) & (interner->shard_count - 1)];
+        mtx_lock(&shard->mtx);
+        result = fox__intern_shard__(shard, sv, hash);
+        mtx_unlock(&shard->mtx);
+    }
+    fox_arena_scope_end(prev_arena);
+    return result;
+}
+
+// Every arena allocation is prefixed by its size,
+// this is what makes fox_arena_realloc possible
+typedef union {
+    size_t size;
+    max_align_t align;
+} FoxArenaHeader;
+
+typedef struct FoxArenaChunk {
+    struct FoxArenaChunk *next;
+    size_t size;
+    size_t capacity;
+    _Alignas(max_align_t) u8 data[];
+} FoxArenaChunk;
+
+static size_t fox__arena_align__(size_t size) {
+    const size_t align = _Alignof(max_align_t);
+    FOX_ASSERT(size <= SIZE_MAX - align, "arena allocation is too large");
+    return (size + align - 1) & ~(align - 1);
+}
+
+static bool fox__arena_owns__(const FoxArena *arena, const void *p) {
+    const u8 *ptr = p;
+    for (const FoxArenaChunk *chunk = arena->begin; chunk; chunk = chunk->next) {
+        if (ptr >= chunk->data && ptr < chunk->data + chunk->size)
+            return true;
+        if (chunk == arena->end)
+            break;
+    }
+    return false;
+}
+
+void *fox_arena_alloc(FoxArena *arena, size_t size) {
+    if (!arena)
+        return NULL;
+
+    size_t needed = sizeof(FoxArenaHeader) + fox__arena_align__(size);
+    // Find a chunk that fits, chunks after end are left over from a rewind
+    FoxArenaChunk *chunk = arena->end;
+    if (chunk && chunk->capacity - chunk->size < needed) {
+        chunk = chunk->next;
+        while (chunk && chunk->capacity < needed)
+            chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        size_t chunk_size = arena->chunk_size ? arena->chunk_size : FOX_ARENA_CHUNK_SIZE;
+        size_t capacity = needed > chunk_size ? needed : chunk_size;
+        chunk = malloc(sizeof(FoxArenaChunk) + capacity);
+        FOX_ASSERT(chunk != NULL, "malloc failed");
+        chunk->size = 0;
+        chunk->capacity = capacity;
+        // Link the new chunk right after the current one
+        if (arena->end) {
+            chunk->next = arena->end->next;
+            arena->end->next = chunk;
+        } else {
+            chunk->next = NULL;
+            arena->begin = chunk;
+        }
+    }
+    arena->end = chunk;
+
+    FoxArenaHeader *header = (FoxArenaHeader *) &chunk->data[chunk->size];
+    header->size = size;
+    chunk->size += needed;
+    return header + 1;
+}
+
+void *fox_arena_realloc(FoxArena *arena, void *p, size_t size) {
+    if (!arena)
+        return NULL;
+    if (p == NULL)
+        return size == 0 ? NULL : fox_arena_alloc(arena, size);
+
+    FoxArenaHeader *header = (FoxArenaHeader *) p - 1;
+    FoxArenaChunk *chunk = arena->end;
+    size_t old_needed = sizeof(FoxArenaHeader) + fox__arena_align__(header->size);
+    bool is_last = chunk && (u8 *) header + old_needed == &chunk->data[chunk->size];
+
+    if (size == 0) {
+        // Only the last allocation can actually be given back
+        if (is_last)
+            chunk->size -= old_needed;
+        return NULL;
+    }
+
+    if (is_last) {
+        size_t new_needed = sizeof(FoxArenaHeader) + fox__arena_align__(size);
+        if (chunk->size - old_needed + new_needed <= chunk->capacity) {
+            // Grow or shrink in place
+            chunk->size = chunk->size - old_needed + new_needed;
+            header->size = size;
+            return p;
+        }
+    }
+    if (size <= header->size) {
+        header->size = size;
+        return p;
+    }
+
+    void *result = fox_arena_alloc(arena, size);
+    memcpy(result, p, header->size);
+    return result;
+}
+
+char *fox_arena_sv_dup(FoxArena *arena, FoxStringView sv) {
+    char *result = fox_arena_alloc(arena, sv.size + 1);
+    if (!result)
+        return NULL;
+    if (sv.size > 0)
+        memcpy(result, sv.items, sv.size);
+    result[sv.size] = '\0';
+    return result;
+}
+
+FoxArenaMark fox_arena_mark(FoxArena *arena) {
+    if (!arena || !arena->end)
+        return (FoxArenaMark) {0};
+    return (FoxArenaMark) {
+            .chunk = arena->end,
+            .size = arena->end->size,
+    };
+}
+
+void fox_arena_rewind(FoxArena *arena, FoxArenaMark mark) {
+    if (!arena || !arena->begin)
+        return;
+
+    FoxArenaChunk *chunk = mark.chunk ? mark.chunk : arena->begin;
+    // Everything after the mark is free again, but the chunks are kept for reuse
+    for (FoxArenaChunk *it = chunk->next; it; it = it->next)
+        it->size = 0;
+    chunk->size = mark.chunk ? mark.size : 0;
+    arena->end = chunk;
+}
+
+void fox_arena_reset(FoxArena *arena) { fox_arena_rewind(arena, (FoxArenaMark) {0}); }
+
+void fox_arena_free(FoxArena *arena) {
+    if (!arena)
+        return;
+
+    FoxArenaChunk *chunk = arena->begin;
+    while (chunk) {
+        FoxArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->begin = arena->end = NULL;
+}
+
+FoxArena *fox_arena_scope_begin(FoxArena *arena) {
+    FoxArena *prev = fox__arena_scope__;
+    fox__arena_scope__ = arena;
+    return prev;
+}
+
+void fox_arena_scope_end(FoxArena *prev) { fox__arena_scope__ = prev; }
+
+// Spins first, then yields and finally sleeps, so that blocked threads do not burn a core
+static void fox__backoff__(u32 *attempt) {
+    if (*attempt < 16) {
+        for (volatile u32 i = 0; i < (1u << *attempt); i++) {}
+    } else if (*attempt < 32) {
+        thrd_yield();
+    } else {
+        thrd_sleep(&(struct timespec) {.tv_nsec = 50 * 1000}, NULL);
+        return;
+    }
+    (*attempt)++;
+}
+
+#define FOX__BACKOFF_SPINS__ 32 // Attempts of fox__backoff__ before it starts to sleep
+
+// Absolute time for cnd_timedwait, @p ns from now
+static struct timespec fox__deadline_after__(u64 ns) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    ts.tv_sec += (time_t) (ns / 1000000000);
+    ts.tv_nsec += (long) (ns % 1000000000);
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+bool fox_wait_group_init(FoxWaitGroup *wg) {
+    atomic_init(&wg->count, 0);
+    if (mtx_init(&wg->mtx, mtx_plain) != thrd_success)
+        return false;
+    if (cnd_init(&wg->cnd) != thrd_success) {
+        mtx_destroy(&wg->mtx);
+        return false;
+    }
+    return true;
+}
+
+void fox_wait_group_add(FoxWaitGroup *wg, size_t count) { atomic_fetch_add(&wg->count, count); }
+
+void fox_wait_group_done(FoxWaitGroup *wg) {
+    // The count drops under the lock, so a waiter cannot free the group while it is still used here
+    mtx_lock(&wg->mtx);
+    size_t prev = atomic_fetch_sub(&wg->count, 1);
+    FOX_ASSERT(prev > 0, "fox_wait_group_done called more often than fox_wait_group_add");
+    if (prev == 1)
+        cnd_broadcast(&wg->cnd);
+    mtx_unlock(&wg->mtx);
+}
+
+void fox_wait_group_free(FoxWaitGroup *wg) {
+    mtx_destroy(&wg->mtx);
+    cnd_destroy(&wg->cnd);
+}
+
+typedef struct {
+    _Atomic(FoxTaskFn) fn;
+    _Atomic(void *) arg;
+    _Atomic(FoxWaitGroup *) wg;
+} FoxTaskSlot;
+
+typedef struct FoxDequeBuffer {
+    i64 capacity;
+    struct FoxDequeBuffer *retired; // Older buffers that thieves may still be reading
+    FoxTaskSlot slots[];
+} FoxDequeBuffer;
+
+typedef struct FoxWorker {
+    atomic_llong top;
+    char pad_top[FOX_CACHE_LINE - sizeof(atomic_llong)];
+    atomic_llong bottom;
+    char pad_bottom[FOX_CACHE_LINE - sizeof(atomic_llong)];
+    _Atomic(FoxDequeBuffer *) buffer;
+
+    FoxThreadPool *pool;
+    u64 rng;
+    thrd_t thread;
+} FoxWorker;
+
+static thread_local FoxWorker *fox__current_worker__ = NULL;
+
+static FoxDequeBuffer *fox__deque_buffer_new__(i64 capacity) {
+    FoxDequeBuffer *buffer = calloc(1, sizeof(FoxDequeBuffer) + (size_t) capacity * sizeof(FoxTaskSlot));
+    FOX_ASSERT(buffer != NULL, "calloc failed");
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+static void fox__slot_store__(FoxDequeBuffer *buffer, i64 index, FoxTask task) {
+    FoxTaskSlot *slot = &buffer->slots[index & (buffer->capacity - 1)];
+    atomic_store_explicit(&slot->fn, task.fn, memory_order_relaxed);
+    atomic_store_explicit(&slot->arg, task.arg, memory_order_relaxed);
+    atomic_store_explicit(&slot->wg, task.wg, memory_order_relaxed);
+}
+
+static FoxTask fox__slot_load__(FoxDequeBuffer *buffer, i64 index) {
+    FoxTaskSlot *slot = &buffer->slots[index & (buffer->capacity - 1)];
+    return (FoxTask) {
+            .fn = atomic_load_explicit(&slot->fn, memory_order_relaxed),
+            .arg = atomic_load_explicit(&slot->arg, memory_order_relaxed),
+            .wg = atomic_load_explicit(&slot->wg, memory_order_relaxed),
+    };
+}
+
+// Only the owner of the deque pushes and takes, any thread can steal.
+// Follows "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.)
+static void fox__deque_push__(FoxWorker *worker, FoxTask task) {
+    i64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+    i64 top = atomic_load_explicit(&worker->top, memory_order_acquire);
+    FoxDequeBuffer *buffer = atomic_load_explicit(&worker->buffer, memory_order_relaxed);
+    if (bottom - top > buffer->capacity - 1) {
+        FoxDequeBuffer *bigger = fox__deque_buffer_new__(buffer->capacity * 2);
+        for (i64 i = top; i < bottom; i++)
+            fox__slot_store__(bigger, i, fox__slot_load__(buffer, i));
+        bigger->retired = buffer;
+        atomic_store_explicit(&worker->buffer, bigger, memory_order_release);
+        buffer = bigger;
+    }
+    fox__slot_store__(buffer, bottom, task);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static bool fox__deque_take__(FoxWorker *worker, FoxTask *task) {
+    i64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+    FoxDequeBuffer *buffer = atomic_load_explicit(&worker->buffer, memory_order_relaxed);
+    atomic_store_explicit(&worker->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 top = atomic_load_explicit(&worker->top, memory_order_relaxed);
+
+    bool result = false;
+    if (top <= bottom) {
+        *task = fox__slot_load__(buffer, bottom);
+        result = true;
+        if (top == bottom) {
+            // The last task, race against the thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+                result = false;
+            atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return result;
+}
+
+static bool fox__deque_steal__(FoxWorker *worker, FoxTask *task) {
+    i64 top = atomic_load_explicit(&worker->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 bottom = atomic_load_explicit(&worker->bottom, memory_order_acquire);
+    if (top >= bottom)
+        return false;
+
+    FoxDequeBuffer *buffer = atomic_load_explicit(&worker->buffer, memory_order_acquire);
+    *task = fox__slot_load__(buffer, top);
+    return atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static bool fox__pool_pop_injected__(FoxThreadPool *pool, FoxTask *task) {
+    bool result = false;
+    mtx_lock(&pool->injected_mtx);
+    if (pool->injected_head < pool->injected.size) {
+        *task = pool->injected.items[pool->injected_head++];
+        // Reclaim the consumed prefix once it is the larger half, a steady backlog never drains completely
+        size_t left = pool->injected.size - pool->injected_head;
+        if (left == 0 || (pool->injected_head >= 64 && pool->injected_head > left)) {
+            memmove(pool->injected.items, pool->injected.items + pool->injected_head, left * sizeof(FoxTask));
+            pool->injected.size = left;
+            pool->injected_head = 0;
+        }
+        result = true;
+    }
+    mtx_unlock(&pool->injected_mtx);
+    return result;
+}
+
+static bool fox__pool_find_task__(FoxThreadPool *pool, FoxWorker *self, FoxTask *task) {
+    bool found = (self != NULL && fox__deque_take__(self, task)) || fox__pool_pop_injected__(pool, task);
+    if (!found && pool->worker_count > 1) {
+        // Start stealing at a random victim (xorshift), so that thieves spread out
+        size_t start = 0;
+        if (self != NULL) {
+            self->rng ^= self->rng << 13;
+            self->rng ^= self->rng >> 7;
+            self->rng ^= self->rng << 17;
+            start = (size_t) (self->rng % pool->worker_count);
+        }
+        for (size_t i = 0; i < pool->worker_count && !found; i++) {
+            FoxWorker *victim = &pool->workers[(start + i) % pool->worker_count];
+            if (victim != self)
+                found = fox__deque_steal__(victim, task);
+        }
+    }
+    if (found)
+        atomic_fetch_sub(&pool->pending, 1);
+    return found;
+}
+
+static void fox__run_task__(FoxTask task) {
+    task.fn(task.arg);
+    if (task.wg != NULL)
+        fox_wait_group_done(task.wg);
+}
+
+// Runs one queued task if the calling thread is a worker, so that waiting workers do not starve the pool
+static bool fox__pool_help__(void) {
+    FoxWorker *self = fox__current_worker__;
+    FoxTask task;
+    if (self == NULL || !fox__pool_find_task__(self->pool, self, &task))
+        return false;
+    fox__run_task__(task);
+    return true;
+}
+
+void fox_wait_group_wait(FoxWaitGroup *wg) {
+    if (fox__current_worker__ != NULL) {
+        // Blocking a worker could starve the tasks that we are waiting for, so help instead
+        u32 attempt = 0;
+        while (atomic_load(&wg->count) > 0) {
+            if (fox__pool_help__()) {
+                attempt = 0;
+            } else if (attempt < FOX__BACKOFF_SPINS__) {
+                fox__backoff__(&attempt);
+            } else {
+                // Nothing to help with, nap until the group is done or new tasks may have arrived
+                mtx_lock(&wg->mtx);
+                if (atomic_load(&wg->count) > 0) {
+                    struct timespec ts = fox__deadline_after__(1000000);
+                    cnd_timedwait(&wg->cnd, &wg->mtx, &ts);
+                }
+                mtx_unlock(&wg->mtx);
+            }
+        }
+        // Let fox_wait_group_done leave its critical section, the group may be freed after this
+        mtx_lock(&wg->mtx);
+        mtx_unlock(&wg->mtx);
+        return;
+    }
+
+    mtx_lock(&wg->mtx);
+    while (atomic_load(&wg->count) > 0)
+        cnd_wait(&wg->cnd, &wg->mtx);
+    mtx_unlock(&wg->mtx);
+}
+
+static int fox__pool_worker__(void *arg) {
+    FoxWorker *self = arg;
+    FoxThreadPool *pool = self->pool;
+    fox__current_worker__ = self;
+
+    FoxTask task;
+    u32 attempt = 0;
+    for (;;) {
+        if (fox__pool_find_task__(pool, self, &task)) {
+            fox__run_task__(task);
+            attempt = 0;
+            continue;
+        }
+        // A task is on its way or we lost a race for it
+        bool pending = atomic_load(&pool->pending) > 0;
+        if (pending && attempt < FOX__BACKOFF_SPINS__) {
+            fox__backoff__(&attempt);
+            continue;
+        }
+
+        mtx_lock(&pool->mtx);
+        atomic_fetch_add(&pool->sleeping, 1);
+        if (pending) {
+            // Still nothing to take, nap instead of spinning (a push signals the condition)
+            struct timespec ts = fox__deadline_after__(1000000);
+            cnd_timedwait(&pool->cnd, &pool->mtx, &ts);
+        } else {
+            while (atomic_load(&pool->pending) == 0 && !atomic_load(&pool->stop))
+                cnd_wait(&pool->cnd, &pool->mtx);
+            attempt = 0;
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        bool done = atomic_load(&pool->stop) && atomic_load(&pool->pending) == 0;
+        mtx_unlock(&pool->mtx);
+        if (done)
+            break;
+    }
+    fox__current_worker__ = NULL;
+    return 0;
+}
+
+static void fox__pool_push__(FoxThreadPool *pool, FoxTask task) {
+    // Counted before it is visible, so that the count never drops below zero
+    atomic_fetch_add(&pool->pending, 1);
+
+    FoxWorker *self = fox__current_worker__;
+    if (self != NULL && self->pool == pool) {
+        fox__deque_push__(self, task);
+    } else {
+        FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+        mtx_lock(&pool->injected_mtx);
+        fox_da_append(&pool->injected, task);
+        mtx_unlock(&pool->injected_mtx);
+        fox_arena_scope_end(prev_arena);
+    }
+
+    if (atomic_load(&pool->sleeping) > 0) {
+        mtx_lock(&pool->mtx);
+        cnd_signal(&pool->cnd);
+        mtx_unlock(&pool->mtx);
+    }
+}
+
+void fox_thread_pool_submit(FoxThreadPool *pool, FoxTaskFn fn, void *arg) { fox__pool_push__(pool, (FoxTask) {.fn = fn, .arg = arg}); }
+
+void fox_thread_pool_submit_wg(FoxThreadPool *pool, FoxWaitGroup *wg, FoxTaskFn fn, void *arg) {
+    fox_wait_group_add(wg, 1);
+    fox__pool_push__(pool, (FoxTask) {.fn = fn, .arg = arg, .wg = wg});
+}
+
+static void fox__pool_free_workers__(FoxThreadPool *pool) {
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        FoxDequeBuffer *buffer = atomic_load(&pool->workers[i].buffer);
+        while (buffer != NULL) {
+            FoxDequeBuffer *retired = buffer->retired;
+            free(buffer);
+            buffer = retired;
+        }
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->worker_count = 0;
+}
+
+// Stops and joins the first @p started workers, then frees everything
+static void fox__pool_destroy__(FoxThreadPool *pool, size_t started) {
+    mtx_lock(&pool->mtx);
+    atomic_store(&pool->stop, true);
+    cnd_broadcast(&pool->cnd);
+    mtx_unlock(&pool->mtx);
+    for (size_t i = 0; i < started; i++)
+        thrd_join(pool->workers[i].thread, NULL);
+
+    fox__pool_free_workers__(pool);
+    fox_da_free(&pool->injected);
+    pool->injected_head = 0;
+    mtx_destroy(&pool->injected_mtx);
+    mtx_destroy(&pool->mtx);
+    cnd_destroy(&pool->cnd);
+}
+
+bool fox_thread_pool_init_opt(FoxThreadPool *pool, FoxThreadPoolOpt opt) {
+    size_t threads = opt.threads > 0 ? opt.threads : fox_nprocessors();
+    if (threads == 0)
+        threads = 1;
+
+    *pool = (FoxThreadPool) {0};
+    if (mtx_init(&pool->mtx, mtx_plain) != thrd_success)
+        return false;
+    if (mtx_init(&pool->injected_mtx, mtx_plain) != thrd_success) {
+        mtx_destroy(&pool->mtx);
+        return false;
+    }
+    if (cnd_init(&pool->cnd) != thrd_success) {
+        mtx_destroy(&pool->injected_mtx);
+        mtx_destroy(&pool->mtx);
+        return false;
+    }
+
+    // Every deque exists before the first worker starts stealing
+    pool->workers = calloc(threads, sizeof(FoxWorker));
+    FOX_ASSERT(pool->workers != NULL, "calloc failed");
+    pool->worker_count = threads;
+    for (size_t i = 0; i < threads; i++) {
+        FoxWorker *worker = &pool->workers[i];
+        atomic_init(&worker->top, 0);
+        atomic_init(&worker->bottom, 0);
+        atomic_init(&worker->buffer, fox__deque_buffer_new__(FOX_POOL_DEQUE_CAP));
+        worker->pool = pool;
+        worker->rng = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        if (thrd_create(&pool->workers[i].thread, fox__pool_worker__, &pool->workers[i]) != thrd_success) {
+#ifndef FOX_NO_ECHO
+            fox_log_error("[POOL] Could not start the worker threads of a thread pool");
+#endif // FOX_NO_ECHO
+            // Only the started workers are joined, every deque is freed
+            fox__pool_destroy__(pool, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void fox_thread_pool_free(FoxThreadPool *pool) {
+    if (pool->workers == NULL)
+        return;
+    FOX_ASSERT(fox__current_worker__ == NULL || fox__current_worker__->pool != pool, "a thread pool cannot be freed from its own task");
+    fox__pool_destroy__(pool, pool->worker_count);
+}
+
+static FoxThreadPool fox__def_pool__;
+static once_flag fox__def_pool_once__ = ONCE_FLAG_INIT;
+
+static void fox__def_pool_init__(void) { FOX_ASSERT(fox_thread_pool_init(&fox__def_pool__), "could not start the default thread pool"); }
+
+FoxThreadPool *fox_default_thread_pool(void) {
+    call_once(&fox__def_pool_once__, fox__def_pool_init__);
+    return &fox__def_pool__;
+}
+
+typedef struct {
+    size_t count;
+    size_t grain;
+    size_t chunks;
+    atomic_size_t next_chunk;
+
+    FoxParallelForFn for_fn;
+    FoxParallelReduceFn reduce_fn;
+    void *user;
+    char *partials;
+    size_t partial_size;
+} FoxParallelJob;
+
+// Chunks are claimed dynamically, so a slow chunk does not hold back a whole worker
+static void fox__parallel_run__(void *arg) {
+    FoxParallelJob *job = arg;
+    for (;;) {
+        size_t chunk = atomic_fetch_add_explicit(&job->next_chunk, 1, memory_order_relaxed);
+        if (chunk >= job->chunks)
+            break;
+        size_t begin = chunk * job->grain;
+        size_t end = begin + job->grain < job->count ? begin + job->grain : job->count;
+        if (job->reduce_fn != NULL)
+            job->reduce_fn(job->user, begin, end, job->partials + chunk * job->partial_size);
+        else
+            job->for_fn(job->user, begin, end);
+    }
+}
+
+static size_t fox__parallel_grain__(size_t count, FoxParallelOpt opt) {
+    if (opt.grain > 0)
+        return opt.grain;
+    return (count + FOX_PARALLEL_CHUNKS - 1) / FOX_PARALLEL_CHUNKS;
+}
+
+static void fox__parallel_exec__(FoxParallelJob *job, FoxParallelOpt opt) {
+    job->grain = fox__parallel_grain__(job->count, opt);
+    job->chunks = (job->count + job->grain - 1) / job->grain;
+    atomic_init(&job->next_chunk, 0);
+    if (job->chunks <= 1) {
+        fox__parallel_run__(job);
+        return;
+    }
+
+    FoxThreadPool *pool = opt.pool != NULL ? opt.pool : fox_default_thread_pool();
+    size_t helpers = pool->worker_count < job->chunks - 1 ? pool->worker_count : job->chunks - 1;
+    FoxWaitGroup wg;
+    FOX_ASSERT(fox_wait_group_init(&wg), "could not create a wait group");
+    for (size_t i = 0; i < helpers; i++)
+        fox_thread_pool_submit_wg(pool, &wg, fox__parallel_run__, job);
+    fox__parallel_run__(job);
+    fox_wait_group_wait(&wg);
+    fox_wait_group_free(&wg);
+}
+
+void fox_parallel_for_opt(size_t count, FoxParallelForFn fn, void *user, FoxParallelOpt opt) {
+    if (count == 0)
+        return;
+    FoxParallelJob job = {.count = count, .for_fn = fn, .user = user};
+    fox__parallel_exec__(&job, opt);
+}
+
+void fox_parallel_reduce_opt(size_t count, FoxParallelReduceFn fn, FoxParallelCombineFn combine, void *user, void *result,
+                             size_t result_size, FoxParallelOpt opt) {
+    if (count == 0)
+        return;
+    FoxParallelJob job = {.count = count, .reduce_fn = fn, .user = user, .partial_size = result_size};
+    size_t grain = fox__parallel_grain__(count, opt);
+    size_t chunks = (count + grain - 1) / grain;
+    job.partials = calloc(chunks, result_size);
+    FOX_ASSERT(job.partials != NULL, "calloc failed");
+
+    fox__parallel_exec__(&job, opt);
+    for (size_t i = 0; i < chunks; i++)
+        combine(user, result, job.partials + i * result_size);
+    free(job.partials);
+}
+
+typedef struct {
+    char *items;
+    size_t item_size;
+    FoxDaItemFn item_fn;
+    FoxDaFoldFn fold_fn;
+    FoxParallelCombineFn combine;
+    void *user;
+} FoxDaParallel;
+
+static void fox__da_parallel_for_range__(void *user, size_t begin, size_t end) {
+    FoxDaParallel *da = user;
+    for (size_t i = begin; i < end; i++)
+        da->item_fn(da->user, da->items + i * da->item_size, i);
+}
+
+static void fox__da_parallel_fold_range__(void *user, size_t begin, size_t end, void *partial) {
+    FoxDaParallel *da = user;
+    for (size_t i = begin; i < end; i++)
+        da->fold_fn(da->user, da->items + i * da->item_size, i, partial);
+}
+
+static void fox__da_parallel_combine__(void *user, void *acc, const void *partial) {
+    FoxDaParallel *da = user;
+    da->combine(da->user, acc, partial);
+}
+
+void fox__da_parallel_for__(void *items, size_t size, size_t item_size, FoxDaItemFn fn, void *user, FoxParallelOpt opt) {
+    FoxDaParallel da = {.items = items, .item_size = item_size, .item_fn = fn, .user = user};
+    fox_parallel_for_opt(size, fox__da_parallel_for_range__, &da, opt);
+}
+
+void fox__da_parallel_reduce__(const void *items, size_t size, size_t item_size, FoxDaFoldFn fn, FoxParallelCombineFn combine, void *user,
+                               void *result, size_t result_size, FoxParallelOpt opt) {
+    FoxDaParallel da = {.items = (char *) items, .item_size = item_size, .fold_fn = fn, .combine = combine, .user = user};
+    fox_parallel_reduce_opt(size, fox__da_parallel_fold_range__, fox__da_parallel_combine__, &da, result, result_size, opt);
+}
+
+static size_t fox__pow2_ceil__(size_t n) {
+    size_t result = 2;
+    while (result < n)
+        result <<= 1;
+    return result;
+}
+
+#define FOX__MPMC_DATA_OFFSET__ _Alignof(max_align_t)
+
+static atomic_size_t *fox__mpmc_seq__(FoxMpmcQueue *queue, size_t pos) {
+    return (atomic_size_t *) (queue->cells + (pos & queue->mask) * queue->cell_size);
+}
+
+bool fox__mpmc_init__(FoxMpmcQueue *queue, size_t item_size, size_t capacity) {
+    size_t cap = fox__pow2_ceil__(capacity);
+    size_t cell_size = FOX__MPMC_DATA_OFFSET__ + item_size;
+    cell_size = (cell_size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+    *queue = (FoxMpmcQueue) {.cell_size = cell_size, .item_size = item_size, .mask = cap - 1};
+    queue->cells = malloc(cap * cell_size);
+    if (queue->cells == NULL)
+        return false;
+    for (size_t i = 0; i < cap; i++)
+        atomic_init(fox__mpmc_seq__(queue, i), i);
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    return true;
+}
+
+void fox_mpmc_free(FoxMpmcQueue *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+bool fox__mpmc_try_push__(FoxMpmcQueue *queue, const void *item, size_t item_size) {
+    FOX_ASSERT(item_size == queue->item_size, "item size does not match the queue");
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        atomic_size_t *seq = fox__mpmc_seq__(queue, pos);
+        intptr_t diff = (intptr_t) atomic_load_explicit(seq, memory_order_acquire) - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                memcpy((u8 *) seq + FOX__MPMC_DATA_OFFSET__, item, item_size);
+                atomic_store_explicit(seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Full
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+bool fox__mpmc_try_pop__(FoxMpmcQueue *queue, void *item, size_t item_size) {
+    FOX_ASSERT(item_size == queue->item_size, "item size does not match the queue");
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        atomic_size_t *seq = fox__mpmc_seq__(queue, pos);
+        intptr_t diff = (intptr_t) atomic_load_explicit(seq, memory_order_acquire) - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(item, (u8 *) seq + FOX__MPMC_DATA_OFFSET__, item_size);
+                atomic_store_explicit(seq, pos + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Empty
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+void fox__mpmc_push__(FoxMpmcQueue *queue, const void *item, size_t item_size) {
+    u32 attempt = 0;
+    while (!fox__mpmc_try_push__(queue, item, item_size))
+        fox__backoff__(&attempt);
+}
+
+void fox__mpmc_pop__(FoxMpmcQueue *queue, void *item, size_t item_size) {
+    u32 attempt = 0;
+    while (!fox__mpmc_try_pop__(queue, item, item_size))
+        fox__backoff__(&attempt);
+}
+
+bool fox__spsc_init__(FoxSpscRing *ring, size_t item_size, size_t capacity) {
+    size_t cap = fox__pow2_ceil__(capacity);
+    *ring = (FoxSpscRing) {.item_size = item_size, .mask = cap - 1};
+    ring->items = malloc(cap * item_size);
+    if (ring->items == NULL)
+        return false;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void fox_spsc_free(FoxSpscRing *ring) {
+    free(ring->items);
+    ring->items = NULL;
+}
+
+bool fox__spsc_try_push__(FoxSpscRing *ring, const void *item, size_t item_size) {
+    FOX_ASSERT(item_size == ring->item_size, "item size does not match the ring");
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_cache > ring->mask) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_cache > ring->mask)
+            return false; // Full
+    }
+    memcpy(ring->items + (tail & ring->mask) * item_size, item, item_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool fox__spsc_try_pop__(FoxSpscRing *ring, void *item, size_t item_size) {
+    FOX_ASSERT(item_size == ring->item_size, "item size does not match the ring");
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_cache) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_cache)
+            return false; // Empty
+    }
+    memcpy(item, ring->items + (head & ring->mask) * item_size, item_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+void fox__spsc_push__(FoxSpscRing *ring, const void *item, size_t item_size) {
+    u32 attempt = 0;
+    while (!fox__spsc_try_push__(ring, item, item_size))
+        fox__backoff__(&attempt);
+}
+
+void fox__spsc_pop__(FoxSpscRing *ring, void *item, size_t item_size) {
+    u32 attempt = 0;
+    while (!fox__spsc_try_pop__(ring, item, item_size))
+        fox__backoff__(&attempt);
+}
+
+// Plain malloc, for strings that are freed on another thread or never
+static char *fox__strdup__(const char *str) {
+    if (str == NULL)
+        return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = malloc(len);
+    FOX_ASSERT(copy != NULL, "malloc failed");
+    memcpy(copy, str, len);
+    return copy;
+}
+
+static thread_local u32 fox__metrics_shard__ = UINT32_MAX;
+static atomic_uint fox__metrics_next_shard__ = 0;
+
+void fox_counter_add(FoxCounter *counter, u64 n) {
+    u32 shard = fox__metrics_shard__;
+    if (shard == UINT32_MAX)
+        shard = fox__metrics_shard__ = atomic_fetch_add_explicit(&fox__metrics_next_shard__, 1, memory_order_relaxed) % FOX_METRICS_SHARDS;
+    atomic_fetch_add_explicit(&counter->shards[shard].value, n, memory_order_relaxed);
+}
+
+u64 fox_counter_value(FoxCounter *counter) {
+    u64 value = 0;
+    for (size_t i = 0; i < FOX_METRICS_SHARDS; i++)
+        value += atomic_load_explicit(&counter->shards[i].value, memory_order_relaxed);
+    return value;
+}
+
+void fox_gauge_set(FoxGauge *gauge, i64 value) { atomic_store_explicit(&gauge->value, value, memory_order_relaxed); }
+void fox_gauge_add(FoxGauge *gauge, i64 delta) { atomic_fetch_add_explicit(&gauge->value, delta, memory_order_relaxed); }
+i64 fox_gauge_value(FoxGauge *gauge) { return atomic_load_explicit(&gauge->value, memory_order_relaxed); }
+
+static size_t fox__histogram_bucket__(u64 value) {
+    if (value < (1u << FOX__HISTOGRAM_SUB_BITS__))
+        return (size_t) value;
+    u32 exponent = 63;
+    while ((value >> exponent) == 0)
+        exponent--;
+    u32 shift = exponent - FOX__HISTOGRAM_SUB_BITS__;
+    return ((size_t) (shift + 1) << FOX__HISTOGRAM_SUB_BITS__) + (size_t) ((value >> shift) - (1u << FOX__HISTOGRAM_SUB_BITS__));
+}
+
+// Largest value that falls into @p bucket
+static u64 fox__histogram_bucket_max__(size_t bucket) {
+    if (bucket < (1u << FOX__HISTOGRAM_SUB_BITS__))
+        return bucket;
+    u32 shift = (u32) (bucket >> FOX__HISTOGRAM_SUB_BITS__) - 1;
+    u64 mantissa = (bucket & ((1u << FOX__HISTOGRAM_SUB_BITS__) - 1)) + (1u << FOX__HISTOGRAM_SUB_BITS__);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void fox_histogram_record(FoxHistogram *histogram, u64 value) {
+    atomic_fetch_add_explicit(&histogram->buckets[fox__histogram_bucket__(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    u64 max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+u64 fox_histogram_percentile(FoxHistogram *histogram, double percentile) {
+    u64 count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    if (count == 0)
+        return 0;
+    u64 rank = (u64) (percentile / 100.0 * (double) count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    u64 seen = 0;
+    u64 max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    for (size_t i = 0; i < FOX__HISTOGRAM_BUCKETS__; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            u64 bucket_max = fox__histogram_bucket_max__(i);
+            return bucket_max < max ? bucket_max : max;
+        }
+    }
+    return max;
+}
+
+typedef enum {
+    FOX__METRIC_COUNTER__,
+    FOX__METRIC_GAUGE__,
+    FOX__METRIC_HISTOGRAM__,
+} FoxMetricKind;
+
+typedef struct FoxMetric {
+    FoxMetricKind kind;
+    char *name;
+    _Atomic(struct FoxMetric *) next;
+    // FoxCounter, FoxGauge or FoxHistogram, only as large as the kind needs
+    _Alignas(FOX_CACHE_LINE) unsigned char value[];
+} FoxMetric;
+
+static struct {
+    mtx_t mtx;
+    _Atomic(FoxMetric *) head;
+    _Atomic(FoxMetric *) *tail; // Metrics are printed in the order they were created
+
+    thrd_t thread;
+    cnd_t cnd;
+    bool running;
+    bool stop;
+    char *path;
+    FoxMetricsFormat format;
+    u64 interval_ms;
+} fox__metrics__;
+static once_flag fox__metrics_once__ = ONCE_FLAG_INIT;
+
+static void fox__metrics_init__(void) {
+    FOX_ASSERT(mtx_init(&fox__metrics__.mtx, mtx_plain) == thrd_success, "mtx_init failed");
+    FOX_ASSERT(cnd_init(&fox__metrics__.cnd) == thrd_success, "cnd_init failed");
+    fox__metrics__.tail = &fox__metrics__.head;
+}
+
+static FoxMetric *fox__metrics_get__(const char *name, FoxMetricKind kind) {
+    call_once(&fox__metrics_once__, fox__metrics_init__);
+    mtx_lock(&fox__metrics__.mtx);
+    FoxMetric *metric = atomic_load_explicit(&fox__metrics__.head, memory_order_relaxed);
+    while (metric != NULL && strcmp(metric->name, name) != 0)
+        metric = atomic_load_explicit(&metric->next, memory_order_relaxed);
+    if (metric == NULL) {
+        size_t value_size = kind == FOX__METRIC_COUNTER__ ? sizeof(FoxCounter) : kind == FOX__METRIC_GAUGE__ ? sizeof(FoxGauge) : sizeof(FoxHistogram);
+        // Aligned, so that the shards of a counter sit on their own cache lines
+        size_t size = (offsetof(FoxMetric, value) + value_size + FOX_CACHE_LINE - 1) / FOX_CACHE_LINE * FOX_CACHE_LINE;
+#if defined(FOX_OS_WINDOWS)
+        metric = _aligned_malloc(size, FOX_CACHE_LINE);
+#else
+        metric = aligned_alloc(FOX_CACHE_LINE, size);
+#endif
+        FOX_ASSERT(metric != NULL, "could not allocate a metric");
+        memset(metric, 0, size);
+        metric->kind = kind;
+        metric->name = fox__strdup__(name);
+        // Released, so that fox_metrics_format can walk the list without the lock
+        atomic_store_explicit(fox__metrics__.tail, metric, memory_order_release);
+        fox__metrics__.tail = &metric->next;
+    }
+    mtx_unlock(&fox__metrics__.mtx);
+    FOX_ASSERT(metric->kind == kind, "a metric with this name exists with another kind");
+    return metric;
+}
+
+FoxCounter *fox_metrics_counter(const char *name) { return (FoxCounter *) fox__metrics_get__(name, FOX__METRIC_COUNTER__)->value; }
+FoxGauge *fox_metrics_gauge(const char *name) { return (FoxGauge *) fox__metrics_get__(name, FOX__METRIC_GAUGE__)->value; }
+FoxHistogram *fox_metrics_histogram(const char *name) { return (FoxHistogram *) fox__metrics_get__(name, FOX__METRIC_HISTOGRAM__)->value; }
+
+void fox_metrics_format(FoxStringBuf *sb, FoxMetricsFormat format) {
+    call_once(&fox__metrics_once__, fox__metrics_init__);
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    static const char *const percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+    if (format == FOX_METRICS_JSON)
+        fox_sb_appendf(sb, "{");
+    bool first = true;
+    // Metrics are never removed and every link is published with release, so no lock is needed
+    FoxMetric *metric = atomic_load_explicit(&fox__metrics__.head, memory_order_acquire);
+    for (; metric != NULL; metric = atomic_load_explicit(&metric->next, memory_order_acquire)) {
+        if (format == FOX_METRICS_JSON)
+            fox_sb_appendf(sb, "%s\n  \"%s\": ", first ? "" : ",", metric->name);
+        first = false;
+
+        switch (metric->kind) {
+        case FOX__METRIC_COUNTER__:
+            if (format == FOX_METRICS_JSON)
+                fox_sb_appendf(sb, "%llu", (unsigned long long) fox_counter_value((FoxCounter *) metric->value));
+            else
+                fox_sb_appendf(sb, "%s %llu\n", metric->name, (unsigned long long) fox_counter_value((FoxCounter *) metric->value));
+            break;
+        case FOX__METRIC_GAUGE__:
+            if (format == FOX_METRICS_JSON)
+                fox_sb_appendf(sb, "%lld", (long long) fox_gauge_value((FoxGauge *) metric->value));
+            else
+                fox_sb_appendf(sb, "%s %lld\n", metric->name, (long long) fox_gauge_value((FoxGauge *) metric->value));
+            break;
+        case FOX__METRIC_HISTOGRAM__: {
+            FoxHistogram *histogram = (FoxHistogram *) metric->value;
+            unsigned long long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+            unsigned long long sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+            unsigned long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            if (format == FOX_METRICS_JSON) {
+                fox_sb_appendf(sb, "{\"count\": %llu, \"sum\": %llu, \"max\": %llu", count, sum, max);
+                for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+                    fox_sb_appendf(sb, ", \"%s\": %llu", percentile_names[i],
+                                   (unsigned long long) fox_histogram_percentile(histogram, percentiles[i]));
+                fox_sb_appendf(sb, "}");
+            } else {
+                fox_sb_appendf(sb, "%s.count %llu\n%s.sum %llu\n%s.max %llu\n", metric->name, count, metric->name, sum, metric->name, max);
+                for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+                    fox_sb_appendf(sb, "%s.%s %llu\n", metric->name, percentile_names[i],
+                                   (unsigned long long) fox_histogram_percentile(histogram, percentiles[i]));
+            }
+        } break;
+        default:
+            FOX_UNREACHABLE("fox_metrics_format");
+        }
+    }
+    if (format == FOX_METRICS_JSON)
+        fox_sb_appendf(sb, "\n}\n");
+}
+
+bool fox_metrics_snapshot(const char *path, FoxMetricsFormat format) {
+    bool result;
+    FoxStringBuf sb = {0};
+    FoxStringBuf tmp_path = {0};
+    fox_metrics_format(&sb, format);
+    fox_sb_appendf(&tmp_path, "%s.tmp", path);
+    if (!fox_fs_write_entire_file(tmp_path.items, fox_sv(sb)))
+        fox_return_defer(false);
+    fox_return_defer(fox_fs_rename(tmp_path.items, path));
+
+defer:
+    fox_sb_free(&tmp_path);
+    fox_sb_free(&sb);
+    return result;
+}
+
+static int fox__metrics_thread__(void *arg) {
+    FOX_UNUSED(arg);
+    mtx_lock(&fox__metrics__.mtx);
+    while (!fox__metrics__.stop) {
+        struct timespec ts;
+        timespec_get(&ts, TIME_UTC);
+        u64 nsec = (u64) ts.tv_nsec + fox__metrics__.interval_ms % 1000 * 1000000;
+        ts.tv_sec += (time_t) (fox__metrics__.interval_ms / 1000 + nsec / 1000000000);
+        ts.tv_nsec = (long) (nsec % 1000000000);
+        while (!fox__metrics__.stop && cnd_timedwait(&fox__metrics__.cnd, &fox__metrics__.mtx, &ts) != thrd_timedout) {}
+
+        mtx_unlock(&fox__metrics__.mtx);
+        if (!fox_metrics_snapshot(fox__metrics__.path, fox__metrics__.format)) {
+#ifndef FOX_NO_ECHO
+            fox_log_limited(LOG_ERROR, 1, 1, "could not write the metrics to %s", fox__metrics__.path);
+#endif // FOX_NO_ECHO
+        }
+        mtx_lock(&fox__metrics__.mtx);
+    }
+    mtx_unlock(&fox__metrics__.mtx);
+    return 0;
+}
+
+bool fox_metrics_snapshot_every(const char *path, FoxMetricsFormat format, u64 interval_ms) {
+    call_once(&fox__metrics_once__, fox__metrics_init__);
+    FOX_ASSERT(interval_ms > 0, "the interval must not be zero");
+    fox_metrics_stop();
+
+    mtx_lock(&fox__metrics__.mtx);
+    fox__metrics__.path = fox__strdup__(path);
+    fox__metrics__.format = format;
+    fox__metrics__.interval_ms = interval_ms;
+    fox__metrics__.stop = false;
+    fox__metrics__.running = thrd_create(&fox__metrics__.thread, fox__metrics_thread__, NULL) == thrd_success;
+    bool result = fox__metrics__.running;
+    if (!result) {
+        free(fox__metrics__.path);
+        fox__metrics__.path = NULL;
+    }
+    mtx_unlock(&fox__metrics__.mtx);
+    return result;
+}
+
+void fox_metrics_stop(void) {
+    call_once(&fox__metrics_once__, fox__metrics_init__);
+    mtx_lock(&fox__metrics__.mtx);
+    bool running = fox__metrics__.running;
+    fox__metrics__.stop = true;
+    fox__metrics__.running = false;
+    cnd_signal(&fox__metrics__.cnd);
+    mtx_unlock(&fox__metrics__.mtx);
+    if (!running)
+        return;
+
+    // The thread writes one last snapshot on its way out
+    thrd_join(fox__metrics__.thread, NULL);
+    free(fox__metrics__.path);
+    fox__metrics__.path = NULL;
+}
+
+static inline u64 fox__read64__(const u8 *p) {
+    u64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u64 fox__read32__(const u8 *p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u64 fox__rotl64__(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// 64x64 -> 128 bit multiplication, the low half ends up in *a and the high half in *b
+static inline void fox__mum__(u64 *a, u64 *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (u64) r;
+    *b = (u64) (r >> 64);
+#else
+    u64 ha = *a >> 32, hb = *b >> 32, la = (u32) *a, lb = (u32) *b;
+    u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl;
+    u64 lo = t + (rm1 << 32);
+    c += lo < t;
+    u64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline u64 fox__mix__(u64 a, u64 b) {
+    fox__mum__(&a, &b);
+    return a ^ b;
+}
+
+static const u64 fox__wyp__[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+// Inputs of at most 16 bytes are read as two (overlapping) words
+static inline void fox__wy_short__(const u8 *p, size_t size, u64 *a, u64 *b) {
+    if (size >= 4) {
+        *a = (fox__read32__(p) << 32) | fox__read32__(p + ((size >> 3) << 2));
+        *b = (fox__read32__(p + size - 4) << 32) | fox__read32__(p + size - 4 - ((size >> 3) << 2));
+    } else if (size > 0) {
+        *a = ((u64) p[0] << 16) | ((u64) p[size >> 1] << 8) | p[size - 1];
+        *b = 0;
+    } else {
+        *a = *b = 0;
+    }
+}
+
+u64 fox_hash_bytes(const void *data, size_t size, u64 seed) {
+    const u8 *p = data;
+    const u64 *secret = fox__wyp__;
+    seed ^= fox__mix__(seed ^ secret[0], secret[1]);
+    u64 a, b;
+    if (size <= 16) {
+        fox__wy_short__(p, size, &a, &b);
+    } else {
+        size_t i = size;
+        if (i >= 48) {
+            // Three independent lanes keep the multipliers busy
+            u64 see1 = seed, see2 = seed;
+            do {
+                seed = fox__mix__(fox__read64__(p) ^ secret[1], fox__read64__(p + 8) ^ seed);
+                see1 = fox__mix__(fox__read64__(p + 16) ^ secret[2], fox__read64__(p + 24) ^ see1);
+                see2 = fox__mix__(fox__read64__(p + 32) ^ secret[3], fox__read64__(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = fox__mix__(fox__read64__(p) ^ secret[1], fox__read64__(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = fox__read64__(p + i - 16);
+        b = fox__read64__(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    fox__mum__(&a, &b);
+    return fox__mix__(a ^ secret[0] ^ size, b ^ secret[1]);
+}
+
+FoxHash128 fox_hash128_bytes(const void *data, size_t size, u64 seed) {
+    const u8 *p = data;
+    const u64 *secret = fox__wyp__;
+    u64 low = seed ^ fox__mix__(seed ^ secret[0], secret[1]);
+    u64 high = seed ^ fox__mix__(seed ^ secret[2], secret[3]);
+    u64 a, b;
+    if (size <= 16) {
+        fox__wy_short__(p, size, &a, &b);
+    } else {
+        // Both lanes consume the same words in a different pairing, four independent chains keep the multipliers busy
+        size_t i = size;
+        if (i > 32) {
+            u64 low1 = low, high1 = high;
+            do {
+                u64 w0 = fox__read64__(p), w1 = fox__read64__(p + 8), w2 = fox__read64__(p + 16), w3 = fox__read64__(p + 24);
+                low = fox__mix__(w0 ^ secret[1], w1 ^ low);
+                low1 = fox__mix__(w2 ^ secret[2], w3 ^ low1);
+                high = fox__mix__(w1 ^ secret[3], w2 ^ high);
+                high1 = fox__mix__(w3 ^ secret[0], w0 ^ high1);
+                p += 32;
+                i -= 32;
+            } while (i > 32);
+            low ^= low1;
+            high ^= high1;
+        }
+        while (i > 16) {
+            u64 w0 = fox__read64__(p), w1 = fox__read64__(p + 8);
+            low = fox__mix__(w0 ^ secret[1], w1 ^ low);
+            high = fox__mix__(w1 ^ secret[2], w0 ^ high);
+            i -= 16;
+            p += 16;
+        }
+        a = fox__read64__(p + i - 16);
+        b = fox__read64__(p + i - 8);
+    }
+    u64 la = a ^ secret[1], lb = b ^ low;
+    u64 ha = b ^ secret[2], hb = a ^ high;
+    fox__mum__(&la, &lb);
+    fox__mum__(&ha, &hb);
+    return (FoxHash128) {
+            .low = fox__mix__(la ^ secret[0] ^ size, lb ^ secret[1]),
+            .high = fox__mix__(ha ^ secret[3] ^ size, hb ^ secret[2]),
+    };
+}
+
+#define FOX__XXH_P1__ 0x9E3779B185EBCA87ull
+#define FOX__XXH_P2__ 0xC2B2AE3D27D4EB4Full
+#define FOX__XXH_P3__ 0x165667B19E3779F9ull
+#define FOX__XXH_P4__ 0x85EBCA77C2B2AE63ull
+#define FOX__XXH_P5__ 0x27D4EB2F165667C5ull
+
+static inline u64 fox__xxh_round__(u64 acc, u64 input) {
+    acc += input * FOX__XXH_P2__;
+    acc = fox__rotl64__(acc, 31);
+    return acc * FOX__XXH_P1__;
+}
+
+static inline u64 fox__xxh_merge__(u64 acc, u64 value) {
+    acc ^= fox__xxh_round__(0, value);
+    return acc * FOX__XXH_P1__ + FOX__XXH_P4__;
+}
+
+void fox_hasher_init(FoxHasher *hasher, u64 seed) {
+    *hasher = (FoxHasher) {
+            .acc = {seed + FOX__XXH_P1__ + FOX__XXH_P2__, seed + FOX__XXH_P2__, seed, seed - FOX__XXH_P1__},
+            .seed = seed,
+    };
+}
+
+static const u8 *fox__hasher_stripes__(u64 acc[4], const u8 *p, const u8 *end) {
+    while (p + 32 <= end) {
+        acc[0] = fox__xxh_round__(acc[0], fox__read64__(p));
+        acc[1] = fox__xxh_round__(acc[1], fox__read64__(p + 8));
+        acc[2] = fox__xxh_round__(acc[2], fox__read64__(p + 16));
+        acc[3] = fox__xxh_round__(acc[3], fox__read64__(p + 24));
+        p += 32;
+    }
+    return p;
+}
+
+void fox_hasher_update(FoxHasher *hasher, const void *data, size_t size) {
+    const u8 *p = data;
+    const u8 *end = p + size;
+    hasher->total += size;
+
+    if (hasher->buffered + size < 32) {
+        if (size > 0)
+            memcpy(hasher->buffer + hasher->buffered, p, size);
+        hasher->buffered += size;
+        return;
+    }
+    if (hasher->buffered > 0) {
+        size_t fill = 32 - hasher->buffered;
+        memcpy(hasher->buffer + hasher->buffered, p, fill);
+        fox__hasher_stripes__(hasher->acc, hasher->buffer, hasher->buffer + 32);
+        p += fill;
+        hasher->buffered = 0;
+    }
+    p = fox__hasher_stripes__(hasher->acc, p, end);
+    hasher->buffered = (size_t) (end - p);
+    if (hasher->buffered > 0)
+        memcpy(hasher->buffer, p, hasher->buffered);
+}
+
+u64 fox_hasher_digest(const FoxHasher *hasher) {
+    u64 h;
+    if (hasher->total >= 32) {
+        const u64 *acc = hasher->acc;
+        h = fox__rotl64__(acc[0], 1) + fox__rotl64__(acc[1], 7) + fox__rotl64__(acc[2], 12) + fox__rotl64__(acc[3], 18);
+        for (size_t i = 0; i < 4; i++)
+            h = fox__xxh_merge__(h, acc[i]);
+    } else {
+        h = hasher->seed + FOX__XXH_P5__;
+    }
+    h += hasher->total;
+
+    const u8 *p = hasher->buffer;
+    const u8 *end = p + hasher->buffered;
+    for (; p + 8 <= end; p += 8) {
+        h ^= fox__xxh_round__(0, fox__read64__(p));
+        h = fox__rotl64__(h, 27) * FOX__XXH_P1__ + FOX__XXH_P4__;
+    }
+    if (p + 4 <= end) {
+        h ^= fox__read32__(p) * FOX__XXH_P1__;
+        h = fox__rotl64__(h, 23) * FOX__XXH_P2__ + FOX__XXH_P3__;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * FOX__XXH_P5__;
+        h = fox__rotl64__(h, 11) * FOX__XXH_P1__;
+    }
+
+    h ^= h >> 33;
+    h *= FOX__XXH_P2__;
+    h ^= h >> 29;
+    h *= FOX__XXH_P3__;
+    h ^= h >> 32;
+    return h;
+}
+
+static bool fox__fs_hash_file_chunked__(const char *path, FoxHasher *hasher) {
+    bool result;
+    u8 *chunk = NULL;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        fox_return_defer(false);
+    chunk = malloc(FOX_HASH_CHUNK_SIZE);
+    FOX_ASSERT(chunk != NULL, "malloc failed");
+    size_t n;
+    while ((n = fread(chunk, 1, FOX_HASH_CHUNK_SIZE, f)) > 0)
+        fox_hasher_update(hasher, chunk, n);
+    fox_return_defer(!ferror(f));
+
+defer:
+    free(chunk);
+    if (f)
+        fclose(f);
+    return result;
+}
+
+bool fox_fs_hash_file(const char *path, u64 *hash) {
+    FoxHasher hasher;
+    fox_hasher_init(&hasher, 0);
+    bool hashed = false;
+#if defined(FOX_OS_LINUX)
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            hashed = true;
+        } else {
+            void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+                fox_hasher_update(&hasher, data, (size_t) st.st_size);
+                munmap(data, (size_t) st.st_size);
+                hashed = true;
+            }
+        }
+    }
+    close(fd);
+#endif
+    // Anything that cannot be mapped (pipes, special files, other platforms) is read in chunks
+    if (!hashed && !fox__fs_hash_file_chunked__(path, &hasher))
+        return false;
+    *hash = fox_hasher_digest(&hasher);
+    FOX__METRICS_ADD__("fox.fs.bytes_hashed", hasher.total);
+    return true;
+}
+
+typedef struct {
+    const FoxStringBufs *paths;
+    u64 *hashes;
+    atomic_bool failed;
+} FoxHashFilesJob;
+
+static void fox__fs_hash_files_range__(void *user, size_t begin, size_t end) {
+    FoxHashFilesJob *job = user;
+    for (size_t i = begin; i < end; i++) {
+        if (!fox_fs_hash_file(job->paths->items[i].items, &job->hashes[i])) {
+            job->hashes[i] = 0;
+            atomic_store_explicit(&job->failed, true, memory_order_relaxed);
+        }
+    }
+}
+
+bool fox_fs_hash_files_opt(const FoxStringBufs *paths, u64 *hashes, FoxParallelOpt opt) {
+    FoxHashFilesJob job = {.paths = paths, .hashes = hashes};
+    atomic_init(&job.failed, false);
+    fox_parallel_for_opt(paths->size, fox__fs_hash_files_range__, &job, opt);
+    return !atomic_load(&job.failed);
+}
+
+typedef struct {
+    char *path;
+    const char *rel; // path without the root
+    u64 size;
+    time_t mtime;
+    u64 partial;
+    u64 hash;
+} FoxTreeFile;
+
+typedef struct {
+    FoxTreeFile *items;
+    size_t size;
+    size_t capacity;
+    size_t root_size;
+} FoxTreeFiles;
+
+static void fox__tree_files_free__(FoxTreeFiles *files) {
+    fox_da_foreach(FoxTreeFile, file, files) { free(file->path); }
+    fox_da_free(files);
+}
+
+static void fox__tree_visitor__(FoxDirEntry entry) {
+    FoxTreeFiles *files = entry.arg;
+    FoxFileStatus status;
+    if (!fox_fs_file_status(entry.path, &status) || status.type != FOX_FILE_REGULAR)
+        return;
+    char *path = fox__strdup__(entry.path);
+    size_t skip = files->root_size;
+    while (path[skip] == '/' || path[skip] == '\\')
+        skip++;
+    fox_da_append(files, ((FoxTreeFile) {.path = path, .rel = path + skip, .size = status.size, .mtime = status.last_modified}));
+}
+
+typedef struct {
+    const char *roots[2];
+    FoxTreeFiles files[2];
+    atomic_bool failed;
+} FoxTreeWalkJob;
+
+static void fox__tree_walk_range__(void *user, size_t begin, size_t end) {
+    FoxTreeWalkJob *job = user;
+    for (size_t i = begin; i < end; i++) {
+        job->files[i].root_size = strlen(job->roots[i]);
+        // fox_fs_visit_dir happily visits a root that is not a directory
+        if (!fox_fs_is_dir(job->roots[i]) ||
+            !fox_fs_visit_dir(job->roots[i], fox__tree_visitor__, .arg = &job->files[i], .recursive = true, .nofollow_dir_symlink = true))
+            atomic_store_explicit(&job->failed, true, memory_order_relaxed);
+    }
+}
+
+static int fox__tree_file_cmp_rel__(const void *a, const void *b) {
+    return strcmp(((const FoxTreeFile *) a)->rel, ((const FoxTreeFile *) b)->rel);
+}
+
+// Content keys first so that identical files end up next to each other, names keep the order stable
+static int fox__tree_file_cmp_content__(const void *a, const void *b) {
+    const FoxTreeFile *x = a, *y = b;
+    if (x->size != y->size)
+        return x->size < y->size ? -1 : 1;
+    if (x->partial != y->partial)
+        return x->partial < y->partial ? -1 : 1;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return strcmp(x->path, y->path);
+}
+
+// Walks every root on its own pool task, a root that cannot be walked makes it return false
+static bool fox__tree_walk__(FoxTreeWalkJob *job, size_t count, FoxThreadPool *pool) {
+    atomic_init(&job->failed, false);
+    fox_parallel_for(count, fox__tree_walk_range__, job, .pool = pool, .grain = 1);
+    return !atomic_load(&job->failed);
+}
+
+typedef struct {
+    const FoxTreeFile *old_file;
+    const FoxTreeFile *new_file;
+    bool verify; // size and mtime were not enough
+    bool changed;
+} FoxTreePair;
+
+typedef struct {
+    FoxTreePair *items;
+    size_t size;
+    size_t capacity;
+} FoxTreePairs;
+
+static void fox__tree_verify_range__(void *user, size_t begin, size_t end) {
+    FoxTreePairs *pairs = user;
+    for (size_t i = begin; i < end; i++) {
+        FoxTreePair *pair = &pairs->items[i];
+        if (!pair->verify)
+            continue;
+        u64 old_hash, new_hash;
+        // A file that cannot be read is reported as changed
+        pair->changed = !fox_fs_hash_file(pair->old_file->path, &old_hash) || !fox_fs_hash_file(pair->new_file->path, &new_hash) ||
+                        old_hash != new_hash;
+    }
+}
+
+bool fox_fs_tree_diff_opt(const char *old_path, const char *new_path, FoxTreeDiff *diff, FoxTreeDiffOpt opt) {
+    FOX_ZONE("fox_fs_tree_diff_opt");
+    if (!diff || !old_path || !new_path)
+        return false;
+    bool result;
+    FoxTreeWalkJob job = {.roots = {old_path, new_path}};
+    FoxTreePairs pairs = {0};
+    if (!fox__tree_walk__(&job, 2, opt.pool))
+        fox_return_defer(false);
+
+    FoxTreeFiles *old_files = &job.files[0], *new_files = &job.files[1];
+    if (old_files->size > 0)
+        qsort(old_files->items, old_files->size, sizeof(FoxTreeFile), fox__tree_file_cmp_rel__);
+    if (new_files->size > 0)
+        qsort(new_files->items, new_files->size, sizeof(FoxTreeFile), fox__tree_file_cmp_rel__);
+
+    // Merge the sorted lists, files present in both trees are compared later
+    size_t i = 0, j = 0;
+    while (i < old_files->size || j < new_files->size) {
+        int cmp = i == old_files->size ? 1 : j == new_files->size ? -1 : strcmp(old_files->items[i].rel, new_files->items[j].rel);
+        if (cmp < 0) {
+            fox_da_append(&diff->removed, fox_intern_sv(&diff->strings, fox_sv_from_cstr(old_files->items[i++].rel)));
+        } else if (cmp > 0) {
+            fox_da_append(&diff->added, fox_intern_sv(&diff->strings, fox_sv_from_cstr(new_files->items[j++].rel)));
+        } else {
+            const FoxTreeFile *old_file = &old_files->items[i++], *new_file = &new_files->items[j++];
+            if (old_file->size != new_file->size)
+                fox_da_append(&pairs, ((FoxTreePair) {.old_file = old_file, .new_file = new_file, .changed = true}));
+            else if (opt.always_hash || old_file->mtime != new_file->mtime)
+                fox_da_append(&pairs, ((FoxTreePair) {.old_file = old_file, .new_file = new_file, .verify = true}));
+        }
+    }
+
+    fox_parallel_for(pairs.size, fox__tree_verify_range__, &pairs, .pool = opt.pool, .grain = 1);
+    fox_da_foreach(FoxTreePair, pair, &pairs) {
+        if (pair->changed)
+            fox_da_append(&diff->changed, fox_intern_sv(&diff->strings, fox_sv_from_cstr(pair->new_file->rel)));
+    }
+    fox_return_defer(true);
+
+defer:
+    fox_da_free(&pairs);
+    fox__tree_files_free__(&job.files[0]);
+    fox__tree_files_free__(&job.files[1]);
+    return result;
+}
+
+void fox_tree_diff_free(FoxTreeDiff *diff) {
+    if (!diff)
+        return;
+    fox_da_free(&diff->added);
+    fox_da_free(&diff->removed);
+    fox_da_free(&diff->changed);
+    fox_interner_free(&diff->strings);
+    *diff = (FoxTreeDiff) {0};
+}
+
+typedef struct {
+    FoxTreeFiles *files;
+    size_t partial_size;
+} FoxDedupJob;
+
+static void fox__dedup_partial_range__(void *user, size_t begin, size_t end) {
+    FoxDedupJob *job = user;
+    u8 *buffer = malloc(job->partial_size);
+    FOX_ASSERT(buffer != NULL, "malloc failed");
+    for (size_t i = begin; i < end; i++) {
+        FoxTreeFile *file = &job->files->items[i];
+        FILE *f = fopen(file->path, "rb");
+        size_t n = f ? fread(buffer, 1, job->partial_size, f) : 0;
+        // Unreadable files get a hash of their own so that they do not join a group
+        file->partial = f && !ferror(f) ? fox_hash_bytes(buffer, n, file->size) : fox_hash_bytes(file->path, strlen(file->path), ~0ull);
+        if (f)
+            fclose(f);
+    }
+    free(buffer);
+}
+
+static void fox__dedup_full_range__(void *user, size_t begin, size_t end) {
+    FoxDedupJob *job = user;
+    for (size_t i = begin; i < end; i++) {
+        FoxTreeFile *file = &job->files->items[i];
+        if (!fox_fs_hash_file(file->path, &file->hash))
+            file->hash = fox_hash_bytes(file->path, strlen(file->path), ~0ull);
+    }
+}
+
+static bool fox__dedup_same__(const FoxTreeFile *a, const FoxTreeFile *b) {
+    return a->size == b->size && a->partial == b->partial && a->hash == b->hash;
+}
+
+static void fox__dedup_group__(FoxDuplicates *dups, const FoxTreeFile *begin, const FoxTreeFile *end) {
+    FoxStringViews group = {0};
+    for (const FoxTreeFile *file = begin; file < end; file++)
+        fox_da_append(&group, fox_intern_sv(&dups->strings, fox_sv_from_cstr(file->path)));
+    fox_da_append(dups, group);
+}
+
+bool fox_fs_find_duplicates_opt(const char *path, FoxDuplicates *dups, FoxDedupOpt opt) {
+    FOX_ZONE("fox_fs_find_duplicates_opt");
+    if (!dups || !path)
+        return false;
+    bool result;
+    FoxTreeWalkJob walk = {.roots = {path}};
+    FoxTreeFiles partial = {0}, full = {0};
+    FoxDedupJob job = {.partial_size = opt.partial_size == 0 ? FOX_DEDUP_PARTIAL_SIZE : opt.partial_size};
+    if (!fox__tree_walk__(&walk, 1, opt.pool))
+        fox_return_defer(false);
+
+    // Stage 1: only files that share their size with another file can have a duplicate
+    FoxTreeFiles *files = &walk.files[0];
+    if (files->size > 0)
+        qsort(files->items, files->size, sizeof(FoxTreeFile), fox__tree_file_cmp_content__);
+    for (size_t i = 0, j; i < files->size; i = j) {
+        for (j = i + 1; j < files->size && files->items[j].size == files->items[i].size; j++) {}
+        if (j - i < 2)
+            continue;
+        // Empty files are equal without reading them
+        if (files->items[i].size == 0)
+            fox__dedup_group__(dups, &files->items[i], &files->items[j]);
+        else
+            fox_da_append_many(&partial, &files->items[i], j - i);
+    }
+
+    // Stage 2: hash the first bytes, this settles files that are not larger than that
+    job.files = &partial;
+    fox_parallel_for(partial.size, fox__dedup_partial_range__, &job, .pool = opt.pool, .grain = 1);
+    if (partial.size > 0)
+        qsort(partial.items, partial.size, sizeof(FoxTreeFile), fox__tree_file_cmp_content__);
+    for (size_t i = 0, j; i < partial.size; i = j) {
+        for (j = i + 1; j < partial.size && fox__dedup_same__(&partial.items[j], &partial.items[i]); j++) {}
+        if (j - i < 2)
+            continue;
+        if (partial.items[i].size <= job.partial_size)
+            fox__dedup_group__(dups, &partial.items[i], &partial.items[j]);
+        else
+            fox_da_append_many(&full, &partial.items[i], j - i);
+    }
+
+    // Stage 3: hash the whole file
+    job.files = &full;
+    fox_parallel_for(full.size, fox__dedup_full_range__, &job, .pool = opt.pool, .grain = 1);
+    if (full.size > 0)
+        qsort(full.items, full.size, sizeof(FoxTreeFile), fox__tree_file_cmp_content__);
+    for (size_t i = 0, j; i < full.size; i = j) {
+        for (j = i + 1; j < full.size && fox__dedup_same__(&full.items[j], &full.items[i]); j++) {}
+        if (j - i >= 2)
+            fox__dedup_group__(dups, &full.items[i], &full.items[j]);
+    }
+    fox_return_defer(true);
+
+defer:
+    // The stages share the paths of the walk
+    fox_da_free(&partial);
+    fox_da_free(&full);
+    fox__tree_files_free__(&walk.files[0]);
+    return result;
+}
+
+void fox_duplicates_free(FoxDuplicates *dups) {
+    if (!dups)
+        return;
+    fox_da_foreach(FoxStringViews, group, dups) { fox_da_free(group); }
+    fox_da_free(dups);
+    fox_interner_free(&dups->strings);
+    *dups = (FoxDuplicates) {0};
+}
+
+FoxStringView fox_get_error_message(void) {
+#ifdef FOX_OS_LINUX
+    return fox_sv(strerror(errno));
+#elif defined(FOX_OS_WINDOWS)
+    thread_local static char err_msg_buf[4096];
+    DWORD size = FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, GetLastError(), 0, err_msg_buf,
+                               FOX_ARRLEN(err_msg_buf), NULL);
+    if (size == 0)
+        fox_get_error_message();
+    return fox_sv(err_msg_buf);
+#else
+#    error "Implement this"
+#endif
+}
+
+static void fox__file_sink_close__(FoxSink *sink) {
+    FILE *file = sink->handle;
+    fclose(file);
+}
+
+static void fox__file_sink_flush__(FoxSink *sink) {
+    FILE *file = sink->handle;
+    fflush(file);
+}
+
+typedef struct FoxFileSinkState {
+    FoxFileSinkOpt opt;
+    FoxStringBuf path;
+    FILE *file;
+    size_t file_size;
+    time_t opened_at;
+    u64 last_flush; // in milliseconds
+
+    mtx_t mtx;
+    FoxStringBuf buffer;
+    struct FoxFileSinkState *next; // In fox__file_sinks__
+} FoxFileSinkState;
+
+// Every open file sink, so that a panic can write out their buffers
+static FoxFileSinkState *fox__file_sinks__ = NULL;
+static atomic_flag fox__file_sinks_lock__ = ATOMIC_FLAG_INIT;
+
+static void fox__file_sinks_acquire__(void) {
+    while (atomic_flag_test_and_set_explicit(&fox__file_sinks_lock__, memory_order_acquire))
+        thrd_yield();
+}
+
+static void fox__file_sinks_release__(void) { atomic_flag_clear_explicit(&fox__file_sinks_lock__, memory_order_release); }
+
+static u64 fox__file_sink_now_ms__(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (u64) ts.tv_sec * 1000 + (u64) ts.tv_nsec / 1000000;
+}
+
+static bool fox__file_sink_open__(FoxFileSinkState *state, bool append) {
+    state->file = fopen(state->path.items, append ? "ab" : "wb");
+    if (state->file == NULL)
+        return false;
+    // The sink does its own buffering
+    setvbuf(state->file, NULL, _IONBF, 0);
+    state->file_size = 0;
+    if (append && fseek(state->file, 0, SEEK_END) == 0) {
+        long size = ftell(state->file);
+        state->file_size = size > 0 ? (size_t) size : 0;
+    }
+    state->opened_at = time(NULL);
+    return true;
+}
+
+static void fox__file_sink_rotate__(FoxFileSinkState *state) {
+    fclose(state->file);
+    state->file = NULL;
+
+    // path.N-1 -> path.N, ..., path -> path.1
+    FoxStringBuf from = {0};
+    FoxStringBuf to = {0};
+    for (size_t i = state->opt.max_files; i > 0; i--) {
+        fox_da_clear(&from);
+        fox_da_clear(&to);
+        if (i == 1)
+            fox_sb_concat_sb(&from, &state->path);
+        else
+            fox_sb_appendf(&from, "%s.%zu", state->path.items, i - 1);
+        fox_sb_appendf(&to, "%s.%zu", state->path.items, i);
+        remove(to.items);
+        rename(from.items, to.items);
+    }
+    fox_sb_free(&from);
+    fox_sb_free(&to);
+
+    if (!fox__file_sink_open__(state, false)) {
+#ifndef FOX_NO_ECHO
+        fprintf(stderr, "could not reopen log file %s after rotation: %s\n", state->path.items, strerror(errno));
+#endif // FOX_NO_ECHO
+    }
+}
+
+static void fox__file_sink_flush_locked__(FoxFileSinkState *state) {
+    state->last_flush = state->opt.flush_interval > 0 ? fox__file_sink_now_ms__() : 0;
+    if (state->buffer.size == 0)
+        return;
+
+    bool too_big = state->opt.max_size > 0 && state->file_size > 0 && state->file_size + state->buffer.size > state->opt.max_size;
+    bool too_old = state->opt.rotate_interval > 0 && (u64) (time(NULL) - state->opened_at) >= state->opt.rotate_interval;
+    if (state->file != NULL && (too_big || too_old))
+        fox__file_sink_rotate__(state);
+
+    if (state->file != NULL) {
+        state->file_size += fwrite(state->buffer.items, sizeof(state->buffer.items[0]), state->buffer.size, state->file);
+        if (state->opt.sync) {
+#if defined(FOX_OS_WINDOWS)
+            _commit(_fileno(state->file));
+#else
+            fdatasync(fileno(state->file));
+#endif
+        }
+    }
+    fox_da_clear(&state->buffer);
+}
+
+static void fox__buffered_file_sink_write__(FoxSink *sink, FoxStringView sv) {
+    FoxFileSinkState *state = sink->handle;
+    if (sv.size == 0)
+        return;
+
+    mtx_lock(&state->mtx);
+    // Flush first so that the buffer never grows (unless a single line is bigger than it)
+    if (state->buffer.size + sv.size > state->opt.buffer_size)
+        fox__file_sink_flush_locked__(state);
+    fox_da_append_many(&state->buffer, sv.items, sv.size);
+    if (state->buffer.size >= state->opt.buffer_size ||
+        (state->opt.flush_interval > 0 && fox__file_sink_now_ms__() - state->last_flush >= state->opt.flush_interval))
+        fox__file_sink_flush_locked__(state);
+    mtx_unlock(&state->mtx);
+}
+
+static void fox__buffered_file_sink_flush__(FoxSink *sink) {
+    FoxFileSinkState *state = sink->handle;
+    mtx_lock(&state->mtx);
+    fox__file_sink_flush_locked__(state);
+    mtx_unlock(&state->mtx);
+}
+
+void fox__flush_on_panic__(void) {
+    // The panic may come from a thread that holds one of these locks, so nothing here waits
+    if (atomic_flag_test_and_set_explicit(&fox__file_sinks_lock__, memory_order_acquire))
+        return;
+    for (FoxFileSinkState *state = fox__file_sinks__; state != NULL; state = state->next) {
+        if (mtx_trylock(&state->mtx) == thrd_success) {
+            fox__file_sink_flush_locked__(state);
+            mtx_unlock(&state->mtx);
+        }
+    }
+    fox__file_sinks_release__();
+}
+
+static void fox__buffered_file_sink_close__(FoxSink *sink) {
+    FoxFileSinkState *state = sink->handle;
+    fox__file_sinks_acquire__();
+    for (FoxFileSinkState **link = &fox__file_sinks__; *link != NULL; link = &(*link)->next) {
+        if (*link == state) {
+            *link = state->next;
+            break;
+        }
+    }
+    fox__file_sinks_release__();
+    fox__file_sink_flush_locked__(state);
+    if (state->file != NULL)
+        fclose(state->file);
+    mtx_destroy(&state->mtx);
+    fox_sb_free(&state->buffer);
+    fox_sb_free(&state->path);
+    free(state);
+    sink->handle = NULL;
+}
+
+FoxSink fox_logger_file_sink_opt(const char *path, FoxFileSinkOpt opt) {
+    if (opt.buffer_size == 0)
+        opt.buffer_size = FOX_LOG_FILE_BUFFER_SIZE;
+    // Without a rotated file, rotating would truncate the only copy of the log
+    if ((opt.max_size > 0 || opt.rotate_interval > 0) && opt.max_files == 0)
+        opt.max_files = 1;
+
+    FoxFileSinkState *state = calloc(1, sizeof(*state));
+    if (state == NULL)
+        return (FoxSink) {0};
+    state->opt = opt;
+    // The sink outlives any arena scope of the caller
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    state->path = fox_sb_from_cstr(path);
+    if (!fox__file_sink_open__(state, opt.append) || mtx_init(&state->mtx, mtx_plain) != thrd_success) {
+        if (state->file != NULL)
+            fclose(state->file);
+        fox_sb_free(&state->path);
+        free(state);
+        fox_arena_scope_end(prev_arena);
+        return (FoxSink) {0};
+    }
+    fox_da_reserve(&state->buffer, opt.buffer_size);
+    fox_arena_scope_end(prev_arena);
+    state->last_flush = opt.flush_interval > 0 ? fox__file_sink_now_ms__() : 0;
+
+    fox__file_sinks_acquire__();
+    state->next = fox__file_sinks__;
+    fox__file_sinks__ = state;
+    fox__file_sinks_release__();
+
+    return (FoxSink) {
+            .handle = state,
+            .log_handler = fox_default_log_handler,
+            .sink_write = fox__buffered_file_sink_write__,
+            .sink_close = fox__buffered_file_sink_close__,
+            .sink_flush = fox__buffered_file_sink_flush__,
+    };
+}
+
+static bool fox__call_log_handler__(FoxSink *sink, FoxStringBuf *buf, FoxLogLevel level, const char *path, size_t line, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    bool result = sink->log_handler(sink, buf, level, fmt, path, line, args);
+    va_end(args);
+    return result;
+}
+
+typedef struct {
+    FoxSink inner;
+    FoxLogHandlerFn log_handler; // Handler of the async sink, it also formats the dropped messages notice
+    FoxAsyncOverflow overflow;
+
+    // Bounded MPSC ring buffer (Dmitry Vyukov's sequence numbers)
+    size_t capacity;
+    size_t slot_size;
+    atomic_size_t *seqs;
+    u32 *sizes; // Message size, only valid for the first slot of a message
+    char *data;
+    atomic_size_t tail;
+    size_t head; // Owned by the writer thread
+
+    atomic_size_t written; // Every message before this position is written to inner
+    atomic_size_t dropped;
+    atomic_bool stop;
+
+    atomic_bool sleeping;
+    atomic_uint waiters; // Threads that wait for written to advance (flushes and full buffers)
+    mtx_t mtx;
+    cnd_t cnd;
+    cnd_t drained; // Broadcast by the writer when written advances and someone waits
+    thrd_t writer;
+} FoxAsyncState;
+
+static void fox__async_wake__(FoxAsyncState *state) {
+    if (atomic_load(&state->sleeping)) {
+        mtx_lock(&state->mtx);
+        cnd_signal(&state->cnd);
+        mtx_unlock(&state->mtx);
+    }
+}
+
+// Sleeps until the writer has written every message before @p target
+static void fox__async_wait_written__(FoxAsyncState *state, size_t target) {
+    if (atomic_load(&state->written) >= target)
+        return;
+    mtx_lock(&state->mtx);
+    atomic_fetch_add(&state->waiters, 1);
+    while (atomic_load(&state->written) < target) {
+        cnd_signal(&state->cnd);
+        // The timeout covers a message that another producer has claimed but not yet published
+        struct timespec ts = fox__deadline_after__(10 * 1000 * 1000);
+        cnd_timedwait(&state->drained, &state->mtx, &ts);
+    }
+    atomic_fetch_sub(&state->waiters, 1);
+    mtx_unlock(&state->mtx);
+}
+
+static void fox__async_sink_write__(FoxSink *sink, FoxStringView sv) {
+    FoxAsyncState *state = sink->handle;
+    if (sv.size == 0)
+        return;
+
+    const size_t mask = state->capacity - 1;
+    const size_t bytes = state->capacity * state->slot_size;
+    size_t size = sv.size < bytes ? sv.size : bytes;
+    size_t count = (size + state->slot_size - 1) / state->slot_size;
+
+    size_t pos = atomic_load_explicit(&state->tail, memory_order_relaxed);
+    for (;;) {
+        // Every slot of the message must be free for this lap
+        ptrdiff_t diff = 0;
+        for (size_t i = 0; i < count && diff == 0; i++)
+            diff = (ptrdiff_t) (atomic_load_explicit(&state->seqs[(pos + i) & mask], memory_order_acquire) - (pos + i));
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&state->tail, &pos, pos + count, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // The ring buffer is full
+            switch (state->overflow) {
+            case FOX_ASYNC_BLOCK:
+                // The slots are free once the writer is a whole lap behind them
+                fox__async_wait_written__(state, pos + count - state->capacity);
+                break;
+            case FOX_ASYNC_DROP:
+                FOX__METRICS_ADD__("fox.log.dropped", 1);
+                return;
+            case FOX_ASYNC_DROP_COUNTED:
+                atomic_fetch_add_explicit(&state->dropped, 1, memory_order_relaxed);
+                FOX__METRICS_ADD__("fox.log.dropped", 1);
+                return;
+            default:
+                FOX_UNREACHABLE("fox__async_sink_write__");
+            }
+            pos = atomic_load_explicit(&state->tail, memory_order_relaxed);
+        } else {
+            // Another thread claimed the slots
+            pos = atomic_load_explicit(&state->tail, memory_order_relaxed);
+        }
+    }
+
+    size_t offset = (pos & mask) * state->slot_size;
+    size_t first = size < bytes - offset ? size : bytes - offset;
+    memcpy(&state->data[offset], sv.items, first);
+    memcpy(state->data, sv.items + first, size - first);
+    state->sizes[pos & mask] = (u32) size;
+
+    // Publish the first slot last, so the writer sees the whole message at once
+    for (size_t i = count; i-- > 0;)
+        atomic_store_explicit(&state->seqs[(pos + i) & mask], pos + i + 1, memory_order_release);
+    fox__async_wake__(state);
+}
+
+static bool fox__async_drain__(FoxAsyncState *state, FoxStringBuf *batch) {
+    const size_t mask = state->capacity - 1;
+    const size_t bytes = state->capacity * state->slot_size;
+
+    size_t dropped = atomic_exchange_explicit(&state->dropped, 0, memory_order_relaxed);
+    if (dropped > 0 && state->log_handler) {
+        // The notice goes through the same handler as the messages, the inner sink may expect binary records
+        FoxSink notice = {.min_level = LOG_TRACE, .log_handler = state->log_handler};
+        fox__call_log_handler__(&notice, batch, LOG_WARNING, __FILE__, __LINE__, "%zu log messages were dropped", dropped);
+    }
+
+    while (batch->size < FOX_ASYNC_LOG_BATCH_SIZE) {
+        size_t head = state->head;
+        if (atomic_load_explicit(&state->seqs[head & mask], memory_order_acquire) != head + 1)
+            break;
+
+        size_t size = state->sizes[head & mask];
+        size_t count = (size + state->slot_size - 1) / state->slot_size;
+        size_t offset = (head & mask) * state->slot_size;
+        size_t first = size < bytes - offset ? size : bytes - offset;
+        fox_sb_concat_sv(batch, fox_sv_from_raw(&state->data[offset], first));
+        fox_sb_concat_sv(batch, fox_sv_from_raw(state->data, size - first));
+
+        // Give the slots back for the next lap
+        for (size_t i = 0; i < count; i++)
+            atomic_store_explicit(&state->seqs[(head + i) & mask], head + i + state->capacity, memory_order_release);
+        state->head = head + count;
+    }
+
+    if (batch->size == 0)
+        return false;
+    if (state->inner.sink_write)
+        state->inner.sink_write(&state->inner, fox_sv(*batch));
+    fox_da_clear(batch);
+    // Sequentially consistent with the waiters count, so that a waiter either sees the new position or gets woken up
+    atomic_store(&state->written, state->head);
+    if (atomic_load(&state->waiters) > 0) {
+        mtx_lock(&state->mtx);
+        cnd_broadcast(&state->drained);
+        mtx_unlock(&state->mtx);
+    }
+    return true;
+}
+
+static int fox__async_writer__(void *arg) {
+    FoxAsyncState *state = arg;
+    FoxStringBuf batch = {0};
+    for (;;) {
+        if (fox__async_drain__(state, &batch))
+            continue;
+
+        if (atomic_load(&state->stop)) {
+            // Wait for the messages that are claimed but not yet published
+            if (state->head == atomic_load(&state->tail))
+                break;
+            thrd_yield();
+            continue;
+        }
+
+        mtx_lock(&state->mtx);
+        atomic_store(&state->sleeping, true);
+        size_t head = state->head;
+        if (atomic_load_explicit(&state->seqs[head & (state->capacity - 1)], memory_order_acquire) != head + 1 && !atomic_load(&state->stop)) {
+            // The timeout covers a wake up that is missed while going to sleep
+            struct timespec ts;
+            timespec_get(&ts, TIME_UTC);
+            ts.tv_nsec += 10 * 1000 * 1000;
+            if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            cnd_timedwait(&state->cnd, &state->mtx, &ts);
+        }
+        atomic_store(&state->sleeping, false);
+        mtx_unlock(&state->mtx);
+    }
+    fox_sb_free(&batch);
+    return 0;
+}
+
+static void fox__async_sink_flush__(FoxSink *sink) {
+    FoxAsyncState *state = sink->handle;
+    fox__async_wait_written__(state, atomic_load(&state->tail));
+    if (state->inner.sink_flush)
+        state->inner.sink_flush(&state->inner);
+}
+
+static void fox__async_sink_close__(FoxSink *sink) {
+    FoxAsyncState *state = sink->handle;
+    atomic_store(&state->stop, true);
+    mtx_lock(&state->mtx);
+    cnd_signal(&state->cnd);
+    mtx_unlock(&state->mtx);
+    thrd_join(state->writer, NULL);
+
+    if (state->inner.sink_flush)
+        state->inner.sink_flush(&state->inner);
+    if (state->inner.sink_close)
+        state->inner.sink_close(&state->inner);
+
+    mtx_destroy(&state->mtx);
+    cnd_destroy(&state->cnd);
+    cnd_destroy(&state->drained);
+    free(state->seqs);
+    free(state->sizes);
+    free(state->data);
+    free(state);
+    sink->handle = NULL;
+}
+
+FoxSink fox_logger_async_sink_opt(FoxSink inner, FoxAsyncSinkOpt opt) {
+    if (opt.capacity == 0)
+        opt.capacity = FOX_ASYNC_LOG_CAPACITY;
+    if (opt.slot_size == 0)
+        opt.slot_size = FOX_ASYNC_LOG_SLOT_SIZE;
+    FOX_ASSERT((opt.capacity & (opt.capacity - 1)) == 0, "capacity of async sink must be a power of 2");
+    FOX_ASSERT(opt.capacity * opt.slot_size <= UINT32_MAX, "async sink is too big");
+
+    FoxAsyncState *state = calloc(1, sizeof(*state));
+    if (state == NULL)
+        return inner;
+    state->inner = inner;
+    state->inner.pattern = (FoxLogPattern) {0};
+    state->log_handler = inner.log_handler;
+    state->overflow = opt.overflow;
+    state->capacity = opt.capacity;
+    state->slot_size = opt.slot_size;
+    state->seqs = malloc(opt.capacity * sizeof(state->seqs[0]));
+    state->sizes = malloc(opt.capacity * sizeof(state->sizes[0]));
+    state->data = malloc(opt.capacity * opt.slot_size);
+    if (state->seqs == NULL || state->sizes == NULL || state->data == NULL)
+        goto fail;
+    for (size_t i = 0; i < opt.capacity; i++)
+        atomic_init(&state->seqs[i], i);
+
+    if (mtx_init(&state->mtx, mtx_plain) != thrd_success)
+        goto fail;
+    if (cnd_init(&state->cnd) != thrd_success) {
+        mtx_destroy(&state->mtx);
+        goto fail;
+    }
+    if (cnd_init(&state->drained) != thrd_success) {
+        cnd_destroy(&state->cnd);
+        mtx_destroy(&state->mtx);
+        goto fail;
+    }
+    if (thrd_create(&state->writer, fox__async_writer__, state) != thrd_success) {
+        cnd_destroy(&state->drained);
+        cnd_destroy(&state->cnd);
+        mtx_destroy(&state->mtx);
+        goto fail;
+    }
+
+    return (FoxSink) {
+            .handle = state,
+            .min_level = inner.min_level,
+            .pattern = inner.pattern, // The handler runs with the async sink
+            .log_handler = inner.log_handler,
+            .sink_write = fox__async_sink_write__,
+            .sink_close = fox__async_sink_close__,
+            .sink_flush = fox__async_sink_flush__,
+    };
+
+fail:
+#ifndef FOX_NO_ECHO
+    fprintf(stderr, "could not create async log sink, logging synchronously\n");
+#endif // FOX_NO_ECHO
+    free(state->seqs);
+    free(state->sizes);
+    free(state->data);
+    free(state);
+    return inner;
+}
+
+// Time of the binary record that is being formatted, 0 means now
+static thread_local u64 fox__log_recorded_ns__ = 0;
+
+static void fox__log_clock__(struct timespec *ts) {
+    if (fox__log_recorded_ns__ != 0) {
+        ts->tv_sec = (time_t) (fox__log_recorded_ns__ / 1000000000);
+        ts->tv_nsec = (long) (fox__log_recorded_ns__ % 1000000000);
+        return;
+    }
+#if defined(FOX_LOG_COARSE_CLOCK) && defined(CLOCK_REALTIME_COARSE)
+    clock_gettime(CLOCK_REALTIME_COARSE, ts);
+#else
+    timespec_get(ts, TIME_UTC);
+#endif
+}
+
+typedef struct {
+    u32 size; // Size of the whole record
+    u32 line;
+    u8 level;
+    u8 flags;
+    u16 reserved;
+    u64 timestamp;
+    u64 fmt;  // Pointer to the format string, or its length if it is inline
+    u64 path; // Pointer to the path, or its length if it is inline
+} FoxBinaryLogHeader;
+
+// The format string and the path follow the header
+#define FOX__BINLOG_INLINE__ 0x1
+
+typedef struct {
+    const char *begin; // Points to the '%'
+    const char *end;
+    int stars;
+    bool precision_star;
+    int precision; // -1 if there is no precision
+    char length;   // 'H' for hh, 'q' for ll and the modifier itself otherwise
+    char conv;
+} FoxFmtSpec;
+
+static bool fox__fmt_next_spec__(const char *fmt, FoxFmtSpec *spec) {
+    const char *p = strchr(fmt, '%');
+    if (p == NULL)
+        return false;
+
+    spec->begin = p++;
+    spec->stars = 0;
+    spec->precision_star = false;
+    spec->precision = -1;
+    spec->length = 0;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL)
+        p++;
+    if (*p == '*') {
+        spec->stars++;
+        p++;
+    } else {
+        while (isdigit((unsigned char) *p))
+            p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            spec->precision_star = true;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (isdigit((unsigned char) *p))
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+        }
+    }
+    switch (*p) {
+    case 'h':
+    case 'l':
+        spec->length = *p++;
+        if (*p == spec->length) {
+            spec->length = spec->length == 'h' ? 'H' : 'q';
+            p++;
+        }
+        break;
+    case 'j':
+    case 'z':
+    case 't':
+    case 'L':
+        spec->length = *p++;
+        break;
+    }
+    spec->conv = *p;
+    spec->end = *p != '\0' ? p + 1 : p;
+    return true;
+}
+
+static void fox__binlog_put__(FoxStringBuf *buf, const void *data, size_t size) { fox_da_append_many(buf, (const char *) data, size); }
+
+bool fox_binary_log_handler(FoxSink *sink, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args) {
+    if (level < sink->min_level || level >= LOG_NO_LOGS)
+        return false;
+
+    struct timespec ts;
+    fox__log_clock__(&ts);
+    FoxBinaryLogHeader header = {
+            .line = (u32) line,
+            .level = (u8) level,
+            .timestamp = (u64) ts.tv_sec * 1000000000 + (u64) ts.tv_nsec,
+            .fmt = (uintptr_t) fmt,
+            .path = (uintptr_t) path,
+    };
+    size_t start = buf->size;
+    fox__binlog_put__(buf, &header, sizeof(header));
+
+    va_list ap;
+    va_copy(ap, args);
+    FoxFmtSpec spec;
+    for (const char *p = fmt; fox__fmt_next_spec__(p, &spec); p = spec.end) {
+        for (int i = 0; i < spec.stars; i++) {
+            i64 star = va_arg(ap, int);
+            fox__binlog_put__(buf, &star, sizeof(star));
+            // A negative precision is taken as if the precision were omitted
+            if (i == spec.stars - 1 && spec.precision_star)
+                spec.precision = star < 0 ? -1 : (int) star;
+        }
+
+        bool unknown = false;
+        switch (spec.conv) {
+        case 'c': {
+            if (spec.length != 0) {
+                unknown = true;
+                break;
+            }
+            i64 value = va_arg(ap, int);
+            fox__binlog_put__(buf, &value, sizeof(value));
+        } break;
+        case 'd':
+        case 'i': {
+            i64 value;
+            switch (spec.length) {
+            case 'l':
+                value = va_arg(ap, long);
+                break;
+            case 'q':
+                value = va_arg(ap, long long);
+                break;
+            case 'j':
+                value = va_arg(ap, intmax_t);
+                break;
+            case 'z':
+                value = (i64) va_arg(ap, size_t);
+                break;
+            case 't':
+                value = va_arg(ap, ptrdiff_t);
+                break;
+            default:
+                value = va_arg(ap, int);
+                break;
+            }
+            fox__binlog_put__(buf, &value, sizeof(value));
+        } break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            u64 value;
+            switch (spec.length) {
+            case 'l':
+                value = va_arg(ap, unsigned long);
+                break;
+            case 'q':
+                value = va_arg(ap, unsigned long long);
+                break;
+            case 'j':
+                value = va_arg(ap, uintmax_t);
+                break;
+            case 'z':
+                value = va_arg(ap, size_t);
+                break;
+            case 't':
+                value = (u64) va_arg(ap, ptrdiff_t);
+                break;
+            default:
+                value = va_arg(ap, unsigned int);
+                break;
+            }
+            fox__binlog_put__(buf, &value, sizeof(value));
+        } break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double value = spec.length == 'L' ? (double) va_arg(ap, long double) : va_arg(ap, double);
+            fox__binlog_put__(buf, &value, sizeof(value));
+        } break;
+        case 's': {
+            if (spec.length != 0) {
+                unknown = true;
+                break;
+            }
+            const char *str = va_arg(ap, const char *);
+            if (str == NULL)
+                str = "(null)";
+            u32 size = 0;
+            while ((spec.precision < 0 || size < (u32) spec.precision) && str[size] != '\0')
+                size++;
+            fox__binlog_put__(buf, &size, sizeof(size));
+            fox__binlog_put__(buf, str, size);
+            fox_da_append(buf, '\0');
+        } break;
+        case 'p': {
+            u64 value = (uintptr_t) va_arg(ap, void *);
+            fox__binlog_put__(buf, &value, sizeof(value));
+        } break;
+        case 'n':
+            va_arg(ap, void *);
+            break;
+        case '%':
+            break;
+        default:
+            unknown = true;
+            break;
+        }
+        // The type of the argument is unknown, so the rest of the format string is kept as it is
+        if (unknown)
+            break;
+    }
+    va_end(ap);
+
+    header.size = (u32) (buf->size - start);
+    memcpy(&buf->items[start], &header.size, sizeof(header.size));
+    return true;
+}
+
+static bool fox__binlog_get__(const char **cur, const char *end, void *data, size_t size) {
+    if ((size_t) (end - *cur) < size)
+        return false;
+    memcpy(data, *cur, size);
+    *cur += size;
+    return true;
+}
+
+#define fox__binlog_appendf__(sb, spec, stars, star_args, value)                                                                                     \
+    do {                                                                                                                                             \
+        switch (stars) {                                                                                                                             \
+        case 0:                                                                                                                                      \
+            fox_sb_appendf((sb), (spec), (value));                                                                                                   \
+            break;                                                                                                                                   \
+        case 1:                                                                                                                                      \
+            fox_sb_appendf((sb), (spec), (int) (star_args)[0], (value));                                                                             \
+            break;                                                                                                                                   \
+        default:                                                                                                                                     \
+            fox_sb_appendf((sb), (spec), (int) (star_args)[0], (int) (star_args)[1], (value));                                                       \
+            break;                                                                                                                                   \
+        }                                                                                                                                            \
+    } while (false)
+
+bool fox_binary_log_decode(FoxStringView *bytes, FoxBinaryLogEntry *entry) {
+    FoxBinaryLogHeader header;
+    if (bytes->size < sizeof(header))
+        return false;
+    memcpy(&header, bytes->items, sizeof(header));
+    if (header.size < sizeof(header) || header.size > bytes->size)
+        return false;
+
+    const char *cur = bytes->items + sizeof(header);
+    const char *end = bytes->items + header.size;
+    const char *fmt;
+    if (header.flags & FOX__BINLOG_INLINE__) {
+        // Both strings are null terminated
+        if (header.fmt >= (u64) (end - cur) || header.path >= (u64) (end - cur) - header.fmt - 1)
+            return false;
+        fmt = cur;
+        cur += header.fmt + 1;
+        entry->path = fox_sv_from_raw(cur, header.path);
+        cur += header.path + 1;
+    } else {
+        fmt = (const char *) (uintptr_t) header.fmt;
+        entry->path = fox_sv((const char *) (uintptr_t) header.path);
+    }
+    entry->level = header.level;
+    entry->line = header.line;
+    entry->timestamp = header.timestamp;
+
+    fox_da_clear(&entry->message);
+    fox_sb_append_null(&entry->message);
+    FoxFmtSpec spec;
+    const char *p = fmt;
+    while (fox__fmt_next_spec__(p, &spec)) {
+        fox_sb_concat_sv(&entry->message, fox_sv_from_raw(p, spec.begin - p));
+        p = spec.begin;
+
+        char spec_fmt[64];
+        size_t spec_size = spec.end - spec.begin;
+        if (spec_size >= sizeof(spec_fmt))
+            break;
+        memcpy(spec_fmt, spec.begin, spec_size);
+        spec_fmt[spec_size] = '\0';
+
+        i64 stars[2] = {0};
+        for (int i = 0; i < spec.stars; i++) {
+            if (!fox__binlog_get__(&cur, end, &stars[i], sizeof(stars[i])))
+                return false;
+        }
+
+        bool unknown = false;
+        switch (spec.conv) {
+        case 'c': {
+            i64 value;
+            if (spec.length != 0) {
+                unknown = true;
+                break;
+            }
+            if (!fox__binlog_get__(&cur, end, &value, sizeof(value)))
+                return false;
+            fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (int) value);
+        } break;
+        case 'd':
+        case 'i': {
+            i64 value;
+            if (!fox__binlog_get__(&cur, end, &value, sizeof(value)))
+                return false;
+            switch (spec.length) {
+            case 'l':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (long) value);
+                break;
+            case 'q':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (long long) value);
+                break;
+            case 'j':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (intmax_t) value);
+                break;
+            case 'z':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (size_t) value);
+                break;
+            case 't':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (ptrdiff_t) value);
+                break;
+            default:
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (int) value);
+                break;
+            }
+        } break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X': {
+            u64 value;
+            if (!fox__binlog_get__(&cur, end, &value, sizeof(value)))
+                return false;
+            switch (spec.length) {
+            case 'l':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (unsigned long) value);
+                break;
+            case 'q':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (unsigned long long) value);
+                break;
+            case 'j':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (uintmax_t) value);
+                break;
+            case 'z':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (size_t) value);
+                break;
+            case 't':
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (ptrdiff_t) value);
+                break;
+            default:
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (unsigned int) value);
+                break;
+            }
+        } break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            double value;
+            if (!fox__binlog_get__(&cur, end, &value, sizeof(value)))
+                return false;
+            if (spec.length == 'L')
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (long double) value);
+            else
+                fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, value);
+        } break;
+        case 's': {
+            u32 size;
+            if (spec.length != 0) {
+                unknown = true;
+                break;
+            }
+            if (!fox__binlog_get__(&cur, end, &size, sizeof(size)) || (size_t) (end - cur) <= size)
+                return false;
+            fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, cur);
+            cur += size + 1;
+        } break;
+        case 'p': {
+            u64 value;
+            if (!fox__binlog_get__(&cur, end, &value, sizeof(value)))
+                return false;
+            fox__binlog_appendf__(&entry->message, spec_fmt, spec.stars, stars, (void *) (uintptr_t) value);
+        } break;
+        case 'n':
+            break;
+        case '%':
+            fox_sb_concat_cstr(&entry->message, "%");
+            break;
+        default:
+            unknown = true;
+            break;
+        }
+        // The rest of the format string is kept as it is
+        if (unknown)
+            break;
+        p = spec.end;
+    }
+    fox_sb_concat_cstr(&entry->message, p);
+
+    bytes->items += header.size;
+    bytes->size -= header.size;
+    return true;
+}
+
+static void fox__binary_sink_write__(FoxSink *sink, FoxStringView sv) {
+    FoxSink *inner = sink->handle;
+    FoxBinaryLogEntry entry = {0};
+    FoxStringBuf buf = {0};
+    while (fox_binary_log_decode(&sv, &entry)) {
+        if (inner->log_handler == NULL || inner->sink_write == NULL)
+            continue;
+        // The path is always null terminated
+        fox__log_recorded_ns__ = entry.timestamp;
+        bool formatted = fox__call_log_handler__(inner, &buf, entry.level, entry.path.items, entry.line, "%s", entry.message.items);
+        fox__log_recorded_ns__ = 0;
+        if (formatted)
+            inner->sink_write(inner, fox_sv(buf));
+        fox_da_clear(&buf);
+    }
+    fox_sb_free(&buf);
+    fox_sb_free(&entry.message);
+}
+
+static void fox__binary_sink_flush__(FoxSink *sink) {
+    FoxSink *inner = sink->handle;
+    if (inner->sink_flush)
+        inner->sink_flush(inner);
+}
+
+static void fox__binary_sink_close__(FoxSink *sink) {
+    FoxSink *inner = sink->handle;
+    if (inner->sink_close)
+        inner->sink_close(inner);
+    fox_log_pattern_free(&inner->pattern);
+    free(inner);
+    sink->handle = NULL;
+}
+
+FoxSink fox_logger_binary_sink(FoxSink inner) {
+    FoxSink *handle = malloc(sizeof(*handle));
+    FOX_ASSERT(handle != NULL, "malloc failed");
+    *handle = inner;
+    return (FoxSink) {
+            .handle = handle,
+            .min_level = inner.min_level,
+            .log_handler = fox_binary_log_handler,
+            .sink_write = fox__binary_sink_write__,
+            .sink_close = fox__binary_sink_close__,
+            .sink_flush = fox__binary_sink_flush__,
+    };
+}
+
+static void fox__binary_file_sink_write__(FoxSink *sink, FoxStringView sv) {
+    FILE *file = sink->handle;
+    FoxStringBuf out = {0};
+    FoxBinaryLogHeader header;
+    while (sv.size >= sizeof(header)) {
+        memcpy(&header, sv.items, sizeof(header));
+        if (header.size < sizeof(header) || header.size > sv.size)
+            break;
+
+        if (header.flags & FOX__BINLOG_INLINE__) {
+            fox__binlog_put__(&out, sv.items, header.size);
+        } else {
+            // Copy the strings into the record so that it can be decoded by another process
+            const char *fmt = (const char *) (uintptr_t) header.fmt;
+            const char *path = (const char *) (uintptr_t) header.path;
+            size_t fmt_size = strlen(fmt);
+            size_t path_size = strlen(path);
+            FoxBinaryLogHeader inline_header = header;
+            inline_header.flags |= FOX__BINLOG_INLINE__;
+            inline_header.fmt = fmt_size;
+            inline_header.path = path_size;
+            inline_header.size = (u32) (header.size + fmt_size + 1 + path_size + 1);
+            fox__binlog_put__(&out, &inline_header, sizeof(inline_header));
+            fox__binlog_put__(&out, fmt, fmt_size + 1);
+            fox__binlog_put__(&out, path, path_size + 1);
+            fox__binlog_put__(&out, sv.items + sizeof(header), header.size - sizeof(header));
+        }
+        sv.items += header.size;
+        sv.size -= header.size;
+    }
+    fwrite(out.items, sizeof(out.items[0]), out.size, file);
+    fox_sb_free(&out);
+}
+
+FoxSink fox_logger_binary_file_sink(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return (FoxSink) {0};
+    return (FoxSink) {
+            .handle = file,
+            .log_handler = fox_binary_log_handler,
+            .sink_write = fox__binary_file_sink_write__,
+            .sink_close = fox__file_sink_close__,
+            .sink_flush = fox__file_sink_flush__,
+    };
+}
+
+void fox_logger_handler(FoxLogger *logger, FoxLogHandlerFn handler) {
+    if (!logger)
+        return;
+    fox_da_foreach(FoxSink, sink, &logger->sinks) sink->log_handler = handler;
+}
+
+void fox_logger_min_level(FoxLogger *logger, FoxLogLevel level) {
+    if (!logger)
+        return;
+    fox_da_foreach(FoxSink, sink, &logger->sinks) sink->min_level = level;
+    atomic_store_explicit(&logger->min_level, (int) level, memory_order_relaxed);
+}
+
+bool fox_logger_pattern(FoxLogger *logger, const char *pattern, bool color) {
+    if (!logger)
+        return false;
+    fox_da_foreach(FoxSink, sink, &logger->sinks) {
+        if (!fox_sink_pattern(sink, pattern, color))
+            return false;
+    }
+    return true;
+}
+
+bool fox_sink_pattern(FoxSink *sink, const char *pattern, bool color) {
+    // The pattern lives as long as the sink
+    FoxLogPattern compiled = {0};
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    bool compiled_ok = fox_log_pattern_compile(&compiled, pattern, color);
+    fox_arena_scope_end(prev_arena);
+    if (!compiled_ok)
+        return false;
+    fox_log_pattern_free(&sink->pattern);
+    sink->pattern = compiled;
+    return true;
+}
+
+void fox_logger_flush(FoxLogger *logger) {
+    if (!logger)
+        return;
+    fox_da_foreach(FoxSink, sink, &logger->sinks) {
+        if (sink->sink_flush)
+            sink->sink_flush(sink);
+    }
+}
+
+void fox_logger_free(FoxLogger *logger) {
+    if (!logger)
+        return;
+    fox_da_foreach(FoxSink, sink, &logger->sinks) {
+        if (sink->sink_close)
+            sink->sink_close(sink);
+        fox_log_pattern_free(&sink->pattern);
+    }
+    fox_da_free(&logger->sinks);
+}
+
+typedef struct {
+    FoxStringBuf buf;
+    bool in_use;
+} FoxLogScratch;
+
+static tss_t fox__log_scratch__;
+static once_flag fox__log_scratch_once__ = ONCE_FLAG_INIT;
+
+static void fox__free_log_scratch__(void *scratch) {
+    FOX__ALLOCS_PAUSE__();
+    fox_sb_free(&((FoxLogScratch *) scratch)->buf);
+    FOX__ALLOCS_RESUME__();
+    free(scratch);
+}
+
+static void fox__init_log_scratch__(void) {
+    if (tss_create(&fox__log_scratch__, fox__free_log_scratch__) != thrd_success)
+        FOX_PANIC("could not create the log scratch buffers");
+}
+
+// Returns the scratch buffer of the calling thread or NULL if it is already in use (a sink that logs)
+static FoxLogScratch *fox__log_scratch_acquire__(void) {
+    call_once(&fox__log_scratch_once__, fox__init_log_scratch__);
+    FoxLogScratch *scratch = tss_get(fox__log_scratch__);
+    if (scratch == NULL) {
+        scratch = calloc(1, sizeof(*scratch));
+        if (scratch == NULL || tss_set(fox__log_scratch__, scratch) != thrd_success) {
+            free(scratch);
+            return NULL;
+        }
+    }
+    if (scratch->in_use)
+        return NULL;
+    scratch->in_use = true;
+    return scratch;
+}
+
+void fox_logger_vlog_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args) {
+    if (!logger || !fox_logger_enabled(logger, level))
+        return;
+    FOX_ZONE("fox_logger_vlog_ext");
+    FOX__METRICS_ADD__("fox.log.lines", 1);
+
+    // The scratch buffer outlives any arena scope of the caller, and lives until the thread exits
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    FOX__ALLOCS_PAUSE__();
+    FoxLogScratch *scratch = fox__log_scratch_acquire__();
+    FoxStringBuf local = {0};
+    FoxStringBuf *buf = scratch != NULL ? &scratch->buf : &local;
+    fox_da_clear(buf);
+
+    fox_da_foreach(FoxSink, sink, &logger->sinks) {
+        bool will_write = false;
+        if (sink->log_handler) {
+            va_list sink_args;
+            va_copy(sink_args, args);
+            will_write = sink->log_handler(sink, buf, level, fmt, path, line, sink_args);
+            va_end(sink_args);
+        }
+        if (sink->sink_write && will_write)
+            sink->sink_write(sink, fox_sv(*buf));
+        // Make sure errors reach their destination before anything else happens
+        if (level >= LOG_ERROR && sink->sink_flush)
+            sink->sink_flush(sink);
+
+        fox_da_clear(buf);
+    }
+
+    // Give back the memory of a rare, very long message
+    if (scratch != NULL) {
+        if (scratch->buf.capacity > FOX_LOG_SCRATCH_MAX)
+            fox_sb_free(&scratch->buf);
+        scratch->in_use = false;
+    }
+    fox_sb_free(&local);
+    FOX__ALLOCS_RESUME__();
+    fox_arena_scope_end(prev_arena);
+}
+
+void fox_logger_log_ext(FoxLogger *logger, FoxLogLevel level, const char *fmt, const char *path, size_t line, ...) {
+    if (!logger || !fox_logger_enabled(logger, level))
+        return;
+    va_list args;
+    va_start(args, line);
+    fox_logger_vlog_ext(logger, level, fmt, path, line, args);
+    va_end(args);
+}
+
+FoxLogger fox_default_logger = {0};
+static once_flag fox__def_log_once__ = ONCE_FLAG_INIT;
+
+static void fox__free_def_log__(void) { fox_logger_free(&fox_default_logger); }
+
+static void fox__init_def_log__(void) {
+    FoxSink default_sink = {
+            .handle = stderr,
+            .log_handler = fox_default_log_handler,
+            .sink_write = fox_default_log_write,
+            .sink_close = NULL,
+    };
+#ifdef FOX_ASYNC_DEFAULT_LOG
+    default_sink = fox_logger_async_sink(default_sink);
+#endif // FOX_ASYNC_DEFAULT_LOG
+    // The default logger outlives any arena scope of the first caller
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    fox_da_append(&fox_default_logger.sinks, default_sink);
+    fox_arena_scope_end(prev_arena);
+    if (atexit(fox__free_def_log__) != 0) {
+        perror("could not register exit hook for fox_default_logger");
+        abort();
+    }
+}
+
+FoxLogger *fox__default_logger__(void) {
+    call_once(&fox__def_log_once__, fox__init_def_log__);
+    return &fox_default_logger;
+}
+
+static const char *const fox__level_names__[] = {"TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "CRITICAL"};
+static const char *const fox__level_colors__[] = {"", "\033[32m", "\033[34m", "\033[93m", "\033[31m", "\033[1m\033[91m"};
+
+static bool fox__pattern_is_datetime__(FoxLogPatternOp op) { return op >= FOX_PATTERN_YEAR && op <= FOX_PATTERN_SECOND; }
+
+bool fox_log_pattern_compile(FoxLogPattern *pattern, const char *str, bool color) {
+    fox_log_pattern_free(pattern);
+    pattern->color = color;
+
+    for (const char *p = str; *p != '\0'; p++) {
+        FoxLogPatternOp op = FOX_PATTERN_LITERAL;
+        if (*p == '%') {
+            p++;
+            switch (*p) {
+            case 'Y':
+                op = FOX_PATTERN_YEAR;
+                break;
+            case 'm':
+                op = FOX_PATTERN_MONTH;
+                break;
+            case 'd':
+                op = FOX_PATTERN_DAY;
+                break;
+            case 'H':
+                op = FOX_PATTERN_HOUR;
+                break;
+            case 'M':
+                op = FOX_PATTERN_MINUTE;
+                break;
+            case 'S':
+                op = FOX_PATTERN_SECOND;
+                break;
+            case 'e':
+                op = FOX_PATTERN_MILLIS;
+                break;
+            case 'f':
+                op = FOX_PATTERN_MICROS;
+                break;
+            case 'F':
+                op = FOX_PATTERN_NANOS;
+                break;
+            case 'l':
+                op = FOX_PATTERN_LEVEL;
+                break;
+            case 'L':
+                op = FOX_PATTERN_SHORT_LEVEL;
+                break;
+            case 't':
+                op = FOX_PATTERN_THREAD;
+                break;
+            case 's':
+                op = FOX_PATTERN_FILE;
+                break;
+            case 'g':
+                op = FOX_PATTERN_PATH;
+                break;
+            case '#':
+                op = FOX_PATTERN_LINE;
+                break;
+            case 'v':
+                op = FOX_PATTERN_MESSAGE;
+                break;
+            case '^':
+                op = FOX_PATTERN_COLOR_BEGIN;
+                break;
+            case '$':
+                op = FOX_PATTERN_COLOR_END;
+                break;
+            case '%':
+                break;
+            default:
+#ifndef FOX_NO_ECHO
+                fprintf(stderr, "unknown flag '%%%c' in log pattern: %s\n", *p, str);
+#endif // FOX_NO_ECHO
+                fox_log_pattern_free(pattern);
+                return false;
+            }
+        }
+
+        if (op == FOX_PATTERN_LITERAL) {
+            // Merge consecutive literal characters into one operation
+            if (pattern->size == 0 || pattern->items[pattern->size - 1].op != FOX_PATTERN_LITERAL) {
+                FoxLogPatternItem item = {.op = FOX_PATTERN_LITERAL, .offset = (u32) pattern->literals.size};
+                fox_da_append(pattern, item);
+            }
+            fox_da_append(&pattern->literals, *p);
+            pattern->items[pattern->size - 1].size++;
+        } else {
+            FoxLogPatternItem item = {.op = op};
+            fox_da_append(pattern, item);
+            if (op >= FOX_PATTERN_YEAR && op <= FOX_PATTERN_NANOS)
+                pattern->has_time = true;
+        }
+    }
+
+    // Group the flags that only change once per second (and the literals between them) into runs
+    for (size_t i = 0; i < pattern->size; i++) {
+        if (!fox__pattern_is_datetime__(pattern->items[i].op))
+            continue;
+        size_t last = i;
+        for (size_t j = i + 1; j < pattern->size; j++) {
+            if (fox__pattern_is_datetime__(pattern->items[j].op))
+                last = j;
+            else if (pattern->items[j].op != FOX_PATTERN_LITERAL)
+                break;
+        }
+        pattern->items[i].size = (u32) (last - i + 1);
+        i = last;
+    }
+
+    static atomic_uint next_id = 1;
+    pattern->id = atomic_fetch_add(&next_id, 1);
+    return true;
+}
+
+void fox_log_pattern_free(FoxLogPattern *pattern) {
+    fox_da_free(pattern);
+    fox_sb_free(&pattern->literals);
+    pattern->id = 0;
+    pattern->color = false;
+    pattern->has_time = false;
+}
+
+static void fox__sb_append_uint__(FoxStringBuf *buf, u64 value, int width) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (int i = count; i < width; i++)
+        fox_da_append(buf, '0');
+    while (count > 0)
+        fox_da_append(buf, digits[--count]);
+}
+
+static u64 fox__thread_id__(void) {
+    static thread_local u64 id = 0;
+    if (id == 0) {
+#if defined(FOX_OS_LINUX)
+        id = (u64) syscall(SYS_gettid);
+#elif defined(FOX_OS_WINDOWS)
+        id = (u64) GetCurrentThreadId();
+#else
+        static atomic_size_t next_id = 1;
+        id = atomic_fetch_add(&next_id, 1);
+#endif
+    }
+    return id;
+}
+
+static const struct tm *fox__log_localtime__(time_t sec) {
+    static thread_local struct {
+        bool valid;
+        time_t sec;
+        struct tm tm;
+    } cache = {0};
+
+    if (!cache.valid || cache.sec != sec) {
+#ifdef FOX_OS_WINDOWS
+        localtime_s(&cache.tm, &sec);
+#else
+        localtime_r(&sec, &cache.tm);
+#endif
+        cache.sec = sec;
+        cache.valid = true;
+    }
+    return &cache.tm;
+}
+
+#define FOX__LOG_DATETIME_SLOTS__ 8 // must be a power of 2
+
+typedef struct {
+    u32 id;
+    size_t index;
+    time_t sec;
+    size_t size;
+    char text[64];
+} FoxLogDatetimeCache;
+
+static void fox__log_append_datetime__(const FoxLogPattern *pattern, size_t index, FoxStringBuf *buf, time_t sec) {
+    // One slot per pattern and datetime run, so that sinks with different patterns do not evict each other
+    static thread_local FoxLogDatetimeCache slots[FOX__LOG_DATETIME_SLOTS__] = {0};
+
+    FoxLogDatetimeCache *cache = &slots[(pattern->id + index) & (FOX__LOG_DATETIME_SLOTS__ - 1)];
+    if (cache->id == pattern->id && cache->index == index && cache->sec == sec && cache->size > 0) {
+        fox_da_append_many(buf, cache->text, cache->size);
+        return;
+    }
+
+    const struct tm *tm = fox__log_localtime__(sec);
+    size_t start = buf->size;
+    for (size_t i = index; i < index + pattern->items[index].size; i++) {
+        const FoxLogPatternItem *item = &pattern->items[i];
+        switch (item->op) {
+        case FOX_PATTERN_LITERAL:
+            fox_da_append_many(buf, &pattern->literals.items[item->offset], item->size);
+            break;
+        case FOX_PATTERN_YEAR:
+            fox__sb_append_uint__(buf, (u64) tm->tm_year + 1900, 4);
+            break;
+        case FOX_PATTERN_MONTH:
+            fox__sb_append_uint__(buf, (u64) tm->tm_mon + 1, 2);
+            break;
+        case FOX_PATTERN_DAY:
+            fox__sb_append_uint__(buf, (u64) tm->tm_mday, 2);
+            break;
+        case FOX_PATTERN_HOUR:
+            fox__sb_append_uint__(buf, (u64) tm->tm_hour, 2);
+            break;
+        case FOX_PATTERN_MINUTE:
+            fox__sb_append_uint__(buf, (u64) tm->tm_min, 2);
+            break;
+        case FOX_PATTERN_SECOND:
+            fox__sb_append_uint__(buf, (u64) tm->tm_sec, 2);
+            break;
+        default:
+            FOX_UNREACHABLE("fox__log_append_datetime__");
         }
-        if (atexit(fox__free_def_log__) != 0) {
-            perror("could not register exit hook for fox_default_logger");
-            abort();
+    }
+
+    // Long runs are simply not cached
+    size_t size = buf->size - start;
+    cache->size = size <= sizeof(cache->text) ? size : 0;
+    if (cache->size > 0) {
+        memcpy(cache->text, &buf->items[start], size);
+        cache->id = pattern->id;
+        cache->index = index;
+        cache->sec = sec;
+    }
+}
+
+void fox_log_pattern_format(const FoxLogPattern *pattern, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line,
+                            va_list args) {
+    FOX_ASSERT(level < LOG_NO_LOGS, "invalid log level");
+
+    struct timespec ts = {0};
+    if (pattern->has_time)
+        fox__log_clock__(&ts);
+
+    for (size_t i = 0; i < pattern->size; i++) {
+        const FoxLogPatternItem *item = &pattern->items[i];
+        switch (item->op) {
+        case FOX_PATTERN_LITERAL:
+            fox_da_append_many(buf, &pattern->literals.items[item->offset], item->size);
+            break;
+        case FOX_PATTERN_YEAR:
+        case FOX_PATTERN_MONTH:
+        case FOX_PATTERN_DAY:
+        case FOX_PATTERN_HOUR:
+        case FOX_PATTERN_MINUTE:
+        case FOX_PATTERN_SECOND:
+            fox__log_append_datetime__(pattern, i, buf, ts.tv_sec);
+            i += item->size - 1;
+            break;
+        case FOX_PATTERN_MILLIS:
+            fox__sb_append_uint__(buf, (u64) ts.tv_nsec / 1000000, 3);
+            break;
+        case FOX_PATTERN_MICROS:
+            fox__sb_append_uint__(buf, (u64) ts.tv_nsec / 1000, 6);
+            break;
+        case FOX_PATTERN_NANOS:
+            fox__sb_append_uint__(buf, (u64) ts.tv_nsec, 9);
+            break;
+        case FOX_PATTERN_LEVEL:
+            fox_da_append_many(buf, fox__level_names__[level], strlen(fox__level_names__[level]));
+            break;
+        case FOX_PATTERN_SHORT_LEVEL:
+            fox_da_append(buf, fox__level_names__[level][0]);
+            break;
+        case FOX_PATTERN_THREAD:
+            fox__sb_append_uint__(buf, fox__thread_id__(), 0);
+            break;
+        case FOX_PATTERN_FILE: {
+            const char *name = path;
+            for (const char *p = path; *p != '\0'; p++) {
+                if (*p == '/' || *p == '\\')
+                    name = p + 1;
+            }
+            fox_da_append_many(buf, name, strlen(name));
+        } break;
+        case FOX_PATTERN_PATH:
+            fox_da_append_many(buf, path, strlen(path));
+            break;
+        case FOX_PATTERN_LINE:
+            fox__sb_append_uint__(buf, line, 0);
+            break;
+        case FOX_PATTERN_MESSAGE: {
+            va_list message_args;
+            va_copy(message_args, args);
+            fox_sb_vappendf(buf, fmt, message_args);
+            va_end(message_args);
+        } break;
+        case FOX_PATTERN_COLOR_BEGIN:
+            if (pattern->color)
+                fox_da_append_many(buf, fox__level_colors__[level], strlen(fox__level_colors__[level]));
+            break;
+        case FOX_PATTERN_COLOR_END:
+            if (pattern->color && *fox__level_colors__[level] != '\0')
+                fox_da_append_many(buf, "\033[0m", 4);
+            break;
+        default:
+            FOX_UNREACHABLE("fox_log_pattern_format");
         }
-        fox__def_log_init__ = true;
     }
+    fox_da_append(buf, '\n');
+    fox_sb_append_null(buf);
+}
+
+static once_flag fox__default_pattern_once__ = ONCE_FLAG_INIT;
+static FoxLogPattern fox__default_pattern__ = {0}; // Lives until the end, sinks may log from exit hooks
+
+static void fox__init_default_pattern__(void) {
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    FOX__ALLOCS_PAUSE__();
+    if (!fox_log_pattern_compile(&fox__default_pattern__, FOX_LOG_DEFAULT_PATTERN, true))
+        FOX_PANIC("could not compile FOX_LOG_DEFAULT_PATTERN");
+    FOX__ALLOCS_RESUME__();
+    fox_arena_scope_end(prev_arena);
 }
 
 bool fox_default_log_handler(FoxSink *sink, FoxStringBuf *buf, FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args) {
-    if (level < sink->min_level)
+    if (level < sink->min_level || level == LOG_NO_LOGS)
         return false;
 
-    const char *level_str = NULL;
-    switch (level) {
-    case LOG_TRACE:
-        level_str = "TRACE";
-        break;
-    case LOG_DEBUG:
-        level_str = "\033[32mDEBUG\033[0m";
-        break;
-    case LOG_INFO:
-        level_str = "\033[34mINFO\033[0m";
-        break;
-    case LOG_WARNING:
-        level_str = "\033[93mWARNING\033[0m";
-        break;
-    case LOG_ERROR:
-        level_str = "\033[31mERROR\033[0m";
-        break;
-    case LOG_CRITICAL:
-        level_str = "\033[1m\033[91mCRITICAL\033[0m";
-        break;
-    case LOG_NO_LOGS:
-        return false;
-    default:
-        FOX_UNREACHABLE("fox_default_log_handler");
+    const FoxLogPattern *pattern = &sink->pattern;
+    if (pattern->size == 0) {
+        call_once(&fox__default_pattern_once__, fox__init_default_pattern__);
+        pattern = &fox__default_pattern__;
     }
-
-    FoxStringBuf fmt_buf = {0};
-    fox_sb_vappendf(&fmt_buf, fmt, args);
-
-    // fox_sb_appendf(buf, "%s:%zu: [%s] %s\n", path, line, level_str, fmt_buf.items);
-    fox_sb_appendf(buf, "[%s] %s\n", level_str, fmt_buf.items);
-    FOX_UNUSED(path);
-    FOX_UNUSED(line);
-    fox_sb_free(&fmt_buf);
+    fox_log_pattern_format(pattern, buf, level, fmt, path, line, args);
     return true;
 }
 
@@ -1586,18 +6568,41 @@ void fox_default_log_write(FoxSink *sink, FoxStringView sv) {
     if (sv.size == 0)
         return;
 
+    // A single fwrite holds the lock of the stream, so sinks on different files never block each other
     FILE *file = sink->handle;
-    mtx_lock(&fox__def_log_mtx__);
     fwrite(sv.items, sizeof(sv.items[0]), sv.size, file);
-    mtx_unlock(&fox__def_log_mtx__);
+}
+
+bool fox_log_limiter_allow(FoxLogLimiter *limiter, double rate, size_t burst, size_t *suppressed) {
+    FOX_ASSERT(rate > 0 && burst > 0, "rate and burst of a log limiter must be positive");
+    const u64 interval = (u64) (1e9 / rate);
+    const u64 tolerance = interval * (burst - 1);
+    const u64 now = fox_time_ns();
+
+    u64 tat = atomic_load_explicit(&limiter->tat, memory_order_relaxed);
+    for (;;) {
+        u64 base = tat > now ? tat : now;
+        if (base - now > tolerance) {
+            atomic_fetch_add_explicit(&limiter->suppressed, 1, memory_order_relaxed);
+            return false;
+        }
+        if (atomic_compare_exchange_weak_explicit(&limiter->tat, &tat, base + interval, memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    if (suppressed != NULL)
+        *suppressed = atomic_exchange_explicit(&limiter->suppressed, 0, memory_order_relaxed);
+    return true;
 }
 
 void fox_vlog_ext(FoxLogLevel level, const char *fmt, const char *path, size_t line, va_list args) {
-    fox__init_def_log__();
-    fox_logger_vlog_ext(&fox_default_logger, level, fmt, path, line, args);
+    if (!fox_logger_enabled(&fox_default_logger, level))
+        return;
+    fox_logger_vlog_ext(fox__default_logger__(), level, fmt, path, line, args);
 }
 
 void fox_log_ext(FoxLogLevel level, const char *fmt, const char *path, size_t line, ...) {
+    if (!fox_logger_enabled(&fox_default_logger, level))
+        return;
     va_list args;
     va_start(args, line);
     fox_vlog_ext(level, fmt, path, line, args);
@@ -1629,6 +6634,7 @@ bool fox_fs_read_entire_file(const char *path, FoxStringBuf *sb) {
     // Do not forget to set the null terminator for compat reasons
     sb->size += size;
     sb->items[sb->size] = '\0';
+    FOX__METRICS_ADD__("fox.fs.bytes_read", (u64) size);
     fox_return_defer(true);
 
 defer:
@@ -1648,6 +6654,7 @@ bool fox_fs_write_entire_file(const char *path, FoxStringView sv) {
     fwrite(sv.items, sizeof(sv.items[0]), sv.size, f);
     if (ferror(f))
         fox_return_defer(false);
+    FOX__METRICS_ADD__("fox.fs.bytes_written", sv.size);
     fox_return_defer(true);
 
 defer:
@@ -1934,9 +6941,25 @@ bool fox_fs_read_entire_dir(const char *path, FoxStringBufs *files) {
     return true;
 }
 
+static void fox__fs_read_dir_ssb_visitor__(FoxDirEntry entry) {
+    FoxSmallStringBufs *files = (FoxSmallStringBufs *) entry.arg;
+    fox_da_append(files, fox_ssb(entry.path));
+}
+
+bool fox_fs_read_entire_dir_ssb(const char *path, FoxSmallStringBufs *files) {
+    if (!files || !path || *path == '\0')
+        return false;
+
+    if (!fox_fs_visit_dir(path, fox__fs_read_dir_ssb_visitor__, .arg = files))
+        return false;
+    return true;
+}
+
 static bool fox__fs_visit_dir__(const char *path, FoxVisitFn visitor, size_t level, bool *stop, FoxVisitOpt opt) {
+    FOX_ZONE("fox__fs_visit_dir__");
     if (!visitor || !path || *path == '\0')
         return false;
+    FOX__METRICS_ADD__("fox.fs.entries_visited", 1);
     if (opt.nofollow_dir_symlink)
         if (fox_fs_is_dir(path) && fox_fs_is_symlink(path))
             goto visit_only_one;
@@ -2768,7 +7791,7 @@ bool fox_fs_remove(const char *path) {
 static void fox__fs_remove_dir_visitor__(FoxDirEntry entry) {
 #ifndef FOX_NO_ECHO
     if (!fox_fs_remove(entry.path))
-        fox_log_error("[FS] Failed to remove: %s", entry.path);
+        fox_log_limited(LOG_ERROR, 10, 20, "[FS] Failed to remove: %s", entry.path);
 #else
     fox_fs_remove(entry.path);
 #endif
@@ -2813,6 +7836,8 @@ static bool fox__fs_copy_file__(const char *from, const char *to) {
         fox_return_defer(false);
     if (!fox_fs_set_status(to, from_status))
         fox_return_defer(false);
+    FOX__METRICS_ADD__("fox.fs.files_copied", 1);
+    FOX__METRICS_ADD__("fox.fs.bytes_copied", sb.size);
     fox_return_defer(true);
 
 defer:
@@ -2910,6 +7935,7 @@ bool fox__cmd_set_nonblocking_pipe__posix(FoxFd fd) {
 #endif // FOX_OS_LINUX
 
 bool fox_cmd_spawn_opt(FoxProc *process, const char *path, const FoxStringViews argv, const FoxSpawnOpt opt) {
+    FOX_ZONE("fox_cmd_spawn_opt");
     if (!path || *path == '\0')
         return false;
 
@@ -2958,35 +7984,29 @@ bool fox_cmd_spawn_opt(FoxProc *process, const char *path, const FoxStringViews
         close(stderr_fd);
         // Change working directory
         if (opt.working_dir.size != 0) {
-            FoxStringBuf tmp = fox_sb(opt.working_dir);
-            if (fox_fs_setcwd(tmp.items)) {
-                fox_sb_free(&tmp);
+            FoxSmallStringBuf tmp = fox_ssb(opt.working_dir);
+            if (fox_fs_setcwd(fox_ssb_data(&tmp))) {
+                fox_ssb_free(&tmp);
                 _exit(127);
             }
-            fox_sb_free(&tmp);
+            fox_ssb_free(&tmp);
         }
-        // The arena to store garbage
-        FoxStringBufs arena;
+        // The arena to store garbage (the arrays are bound to it too)
+        FoxArena arena = {0};
+        fox_arena_scope_begin(&arena);
         // Create the final args array
         CStrs final_args = {0};
         fox_da_append(&final_args, path);
-        fox_da_foreach(FoxStringView, it, &argv) {
-            fox_da_append(&arena, fox_sb(*it));
-            fox_da_append(&final_args, fox_da_back(&arena).items);
-        }
-        fox_da_reserve(&final_args, final_args.size + 1);
-        final_args.items[final_args.size++] = NULL;
+        fox_da_foreach(FoxStringView, it, &argv) { fox_da_append(&final_args, fox_arena_strdup(&arena, *it)); }
+        fox_da_append(&final_args, NULL);
         // Create the final env array
         CStrs final_env = {0};
         if (opt.env && opt.env->size > 0) {
             fox_da_foreach(const FoxEnvEntry, entry, opt.env) {
-                fox_da_append(&arena, fox_sb(entry->key));
-                fox_da_append(&final_env, fox_da_back(&arena).items);
-                fox_da_append(&arena, fox_sb(entry->value));
-                fox_da_append(&final_env, fox_da_back(&arena).items);
+                fox_da_append(&final_env, fox_arena_strdup(&arena, entry->key));
+                fox_da_append(&final_env, fox_arena_strdup(&arena, entry->value));
             }
-            fox_da_reserve(&final_env, final_env.size + 1);
-            final_env.items[final_env.size++] = NULL;
+            fox_da_append(&final_env, NULL);
         }
         // Now run the program
         int ret;
@@ -2995,10 +8015,8 @@ bool fox_cmd_spawn_opt(FoxProc *process, const char *path, const FoxStringViews
         else
             ret = execve(path, (char *const *) final_args.items, (char *const *) final_env.items);
         if (ret == -1) {
-            fox_da_free(&final_env);
-            fox_da_free(&final_args);
-            fox_da_foreach(FoxStringBuf, it, &arena) { fox_sb_free(it); }
-            fox_da_free(&arena);
+            fox_arena_scope_end(NULL);
+            fox_arena_free(&arena);
         }
         _exit(127);
     }
@@ -3171,34 +8189,29 @@ bool fox_cmd_spawn_piped_opt(FoxProc *process, const char *path, const FoxString
         close(err_pipe[1]);
         // Change working directory
         if (opt.working_dir.size != 0) {
-            FoxStringBuf tmp = fox_sb(opt.working_dir);
-            if (fox_fs_setcwd(tmp.items)) {
-                fox_sb_free(&tmp);
+            FoxSmallStringBuf tmp = fox_ssb(opt.working_dir);
+            if (fox_fs_setcwd(fox_ssb_data(&tmp))) {
+                fox_ssb_free(&tmp);
                 _exit(127);
             }
-            fox_sb_free(&tmp);
+            fox_ssb_free(&tmp);
         }
-        // The arena to store garbage
-        FoxStringBufs arena;
+        // The arena to store garbage (the arrays are bound to it too)
+        FoxArena arena = {0};
+        fox_arena_scope_begin(&arena);
         // Create the final argv array
         CStrs final_argv = {0};
         fox_da_append(&final_argv, path);
-        fox_da_foreach(FoxStringView, it, &argv) {
-            fox_da_append(&arena, fox_sb(*it));
-            fox_da_append(&final_argv, fox_da_back(&arena).items);
-        }
-        final_argv.items[final_argv.size++] = NULL;
+        fox_da_foreach(FoxStringView, it, &argv) { fox_da_append(&final_argv, fox_arena_strdup(&arena, *it)); }
+        fox_da_append(&final_argv, NULL);
         // Create the final env array
         CStrs final_env = {0};
-        if (opt.env->size > 0) {
+        if (opt.env && opt.env->size > 0) {
             fox_da_foreach(const FoxEnvEntry, entry, opt.env) {
-                fox_da_append(&arena, fox_sb(entry->key));
-                fox_da_append(&final_env, fox_da_back(&arena).items);
-                fox_da_append(&arena, fox_sb(entry->value));
-                fox_da_append(&final_env, fox_da_back(&arena).items);
+                fox_da_append(&final_env, fox_arena_strdup(&arena, entry->key));
+                fox_da_append(&final_env, fox_arena_strdup(&arena, entry->value));
             }
-            fox_da_reserve(&final_env, final_env.size + 1);
-            final_env.items[final_env.size++] = NULL;
+            fox_da_append(&final_env, NULL);
         }
         // Now run the program
         int ret;
@@ -3207,10 +8220,8 @@ bool fox_cmd_spawn_piped_opt(FoxProc *process, const char *path, const FoxString
         else
             ret = execve(path, (char *const *) final_argv.items, (char *const *) final_env.items);
         if (ret == -1) {
-            fox_da_free(&final_env);
-            fox_da_free(&final_argv);
-            fox_da_foreach(FoxStringBuf, it, &arena) { fox_sb_free(it); }
-            fox_da_free(&arena);
+            fox_arena_scope_end(NULL);
+            fox_arena_free(&arena);
             fox_return_defer(false);
         }
         _exit(127);
@@ -3764,12 +8775,15 @@ void fox__cmd_append__(FoxCmd *cmd, size_t n, ...) {
 void fox_cmd_extend(FoxCmd *cmd, FoxCmd *other) { fox_da_concat(cmd, other); }
 
 static void fox__log_cmd__(const FoxCmd *cmd) {
-    FoxStringBuf buf = fox_sb("");
-    fox_da_foreach(const char *, str, cmd) { fox_sb_appendf(&buf, "%s ", *str); }
-    if (buf.size > 0)
-        fox_sb_pop(&buf);
-    fox_log_info("[CMD] %s", buf.items);
-    fox_sb_free(&buf);
+    // Short commands are built without touching the heap
+    FoxSmallStringBuf buf = {0};
+    fox_da_foreach(const char *, str, cmd) {
+        if (fox_ssb_size(&buf) > 0)
+            fox_ssb_concat(&buf, " ");
+        fox_ssb_concat(&buf, *str);
+    }
+    fox_log_info("[CMD] %s", fox_ssb_data(&buf));
+    fox_ssb_free(&buf);
 }
 
 bool fox_cmd_run_opt(FoxCmd *cmd, FoxCmdOpt opt) {
@@ -3781,10 +8795,12 @@ bool fox_cmd_run_opt(FoxCmd *cmd, FoxCmdOpt opt) {
     bool result;
 
     const char *path = fox_da_front(cmd);
-    FoxStringViews args = {0};
+    FoxSmallArray(FoxStringView, 16) args;
+    fox_da_small_init(&args);
     for (size_t i = 1; i < cmd->size; i++)
         fox_da_append(&args, fox_sv(cmd->items[i]));
-    FoxEnv env = {0};
+    FoxSmallArray(FoxEnvEntry, 8) env;
+    fox_da_small_init(&env);
     if (opt.env)
         for (size_t i = 0; i < opt.env_size; i++) {
             if (i + 1 >= opt.env_size)
@@ -3797,24 +8813,32 @@ bool fox_cmd_run_opt(FoxCmd *cmd, FoxCmdOpt opt) {
 #ifndef FOX_NO_ECHO
     fox__log_cmd__(cmd);
 #endif // FOX_NO_ECHO
-    if (!fox_cmd_spawn_opt(&process, path, args,
+#ifdef FOX_METRICS
+    u64 start_ns = fox_time_ns();
+#endif // FOX_METRICS
+    if (!fox_cmd_spawn_opt(&process, path, (FoxStringViews) {.items = args.items, .size = args.size},
                            (FoxSpawnOpt) {.stdin_path = opt.stdin_path,
                                           .stdout_path = opt.stdout_path,
                                           .stderr_path = opt.stderr_path,
-                                          .env = &env,
+                                          .env = &(FoxEnv) {.items = env.items, .size = env.size},
                                           .working_dir = fox_sv(opt.working_dir)}))
         fox_return_defer(false);
     if (!fox_cmd_wait(&process))
         fox_return_defer(false);
 
+    FOX__METRICS_RECORD__("fox.cmd.run_ns", fox_time_ns() - start_ns);
+    if (process.exit_code != 0)
+        FOX__METRICS_ADD__("fox.cmd.nonzero_exits", 1);
     if (opt.exit_code)
         *opt.exit_code = process.exit_code;
     fox_return_defer(true);
 
 defer:
+    FOX__METRICS_ADD__("fox.cmd.runs", 1);
+    if (!result)
+        FOX__METRICS_ADD__("fox.cmd.failures", 1);
     fox_da_free(&env);
     fox_da_free(&args);
-    fox_da_free(&env);
     if (opt.reset)
         fox_da_clear(cmd);
     return result;
@@ -3824,6 +8848,7 @@ bool fox__auto_build__(const char *src_file, int argc, char *argv[]) {
     FOX_ASSERT(argc >= 1, "argc should be atleast 1");
 
     bool result;
+    FoxCmd cmd = {0};
 
     FoxFileStatus src_status = {0};
     FoxFileStatus exe_status = {0};
@@ -3832,7 +8857,6 @@ bool fox__auto_build__(const char *src_file, int argc, char *argv[]) {
     if (!fox_fs_file_status(argv[0], &exe_status))
         fox_return_defer(false);
 
-    FoxCmd cmd = {0};
     if (src_status.last_modified >= exe_status.last_modified) {
         // Rebuild
         // FIXME: Not portable
@@ -3864,4 +8888,926 @@ u32 fox_nprocessors(void) {
 #endif
 }
 
+u64 fox_time_ns(void) {
+#if defined(FOX_OS_LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000 + (u64) ts.tv_nsec;
+#elif defined(FOX_OS_WINDOWS)
+    static LARGE_INTEGER frequency = {0};
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (u64) (counter.QuadPart / frequency.QuadPart) * 1000000000 + (u64) (counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+#    error "Implement this"
+#endif
+}
+
+struct FoxFuture {
+    bool ready;
+    bool result;
+
+    FoxFutureFn fn;
+    FoxFutureThenFn then_fn;
+    void *arg;
+    bool parent_result;
+
+    FoxFuture *continuations; // Futures waiting for this one, linked through next
+    FoxFuture *next;
+};
+
+// Futures are coarse (processes, whole files), so they share one lock and one condition.
+// This also lets fox_future_wait_any sleep until any of the futures completes.
+static mtx_t fox__future_mtx__;
+static cnd_t fox__future_cnd__;
+static once_flag fox__future_once__ = ONCE_FLAG_INIT;
+
+static void fox__future_init__(void) {
+    FOX_ASSERT(mtx_init(&fox__future_mtx__, mtx_plain) == thrd_success, "mtx_init failed");
+    FOX_ASSERT(cnd_init(&fox__future_cnd__) == thrd_success, "cnd_init failed");
+}
+
+static FoxFuture *fox__future_new__(void) {
+    call_once(&fox__future_once__, fox__future_init__);
+    FoxFuture *future = calloc(1, sizeof(FoxFuture));
+    FOX_ASSERT(future != NULL, "calloc failed");
+    return future;
+}
+
+static void fox__future_task__(void *arg);
+
+static void fox__future_complete__(FoxFuture *future, bool result) {
+    mtx_lock(&fox__future_mtx__);
+    future->ready = true;
+    future->result = result;
+    FoxFuture *continuations = future->continuations;
+    future->continuations = NULL;
+    cnd_broadcast(&fox__future_cnd__);
+    mtx_unlock(&fox__future_mtx__);
+
+    // The future may be freed from here on, continuations only need the result
+    while (continuations != NULL) {
+        FoxFuture *next = continuations->next;
+        continuations->parent_result = result;
+        fox_thread_pool_submit(fox_default_thread_pool(), fox__future_task__, continuations);
+        continuations = next;
+    }
+}
+
+static void fox__future_task__(void *arg) {
+    FoxFuture *future = arg;
+    bool result = future->then_fn != NULL ? future->then_fn(future->parent_result, future->arg) : future->fn(future->arg);
+    fox__future_complete__(future, result);
+}
+
+FoxFuture *fox_future_async(FoxFutureFn fn, void *arg) {
+    FoxFuture *future = fox__future_new__();
+    future->fn = fn;
+    future->arg = arg;
+    fox_thread_pool_submit(fox_default_thread_pool(), fox__future_task__, future);
+    return future;
+}
+
+FoxFuture *fox_future_then(FoxFuture *future, FoxFutureThenFn fn, void *arg) {
+    FoxFuture *then = fox__future_new__();
+    then->then_fn = fn;
+    then->arg = arg;
+
+    mtx_lock(&fox__future_mtx__);
+    bool ready = future->ready;
+    if (!ready) {
+        then->next = future->continuations;
+        future->continuations = then;
+    }
+    mtx_unlock(&fox__future_mtx__);
+
+    if (ready) {
+        then->parent_result = future->result;
+        fox_thread_pool_submit(fox_default_thread_pool(), fox__future_task__, then);
+    }
+    return then;
+}
+
+bool fox_future_is_ready(FoxFuture *future) {
+    mtx_lock(&fox__future_mtx__);
+    bool ready = future->ready;
+    mtx_unlock(&fox__future_mtx__);
+    return ready;
+}
+
+bool fox_future_result(FoxFuture *future) {
+    mtx_lock(&fox__future_mtx__);
+    FOX_ASSERT(future->ready, "the future is not ready");
+    bool result = future->result;
+    mtx_unlock(&fox__future_mtx__);
+    return result;
+}
+
+// Must be called with fox__future_mtx__ locked
+static size_t fox__future_count_ready__(FoxFuture **futures, size_t count, size_t *first) {
+    size_t ready = 0;
+    *first = count;
+    for (size_t i = 0; i < count; i++) {
+        if (futures[i]->ready) {
+            if (ready++ == 0)
+                *first = i;
+        }
+    }
+    return ready;
+}
+
+// Waits until at least @p need futures are ready, returns false on timeout
+static bool fox__future_wait__(FoxFuture **futures, size_t count, size_t need, int timeout_ms, size_t *first) {
+    u64 deadline = timeout_ms < 0 ? 0 : fox_time_ns() + (u64) timeout_ms * 1000000;
+    bool satisfied = false;
+
+    mtx_lock(&fox__future_mtx__);
+    for (;;) {
+        if (fox__future_count_ready__(futures, count, first) >= need) {
+            satisfied = true;
+            break;
+        }
+        u64 now = fox_time_ns();
+        if (timeout_ms >= 0 && now >= deadline)
+            break;
+
+        // A waiting worker keeps running tasks, the futures may depend on them
+        mtx_unlock(&fox__future_mtx__);
+        bool helped = fox__pool_help__();
+        mtx_lock(&fox__future_mtx__);
+        if (helped)
+            continue;
+
+        if (timeout_ms < 0 && fox__current_worker__ == NULL) {
+            cnd_wait(&fox__future_cnd__, &fox__future_mtx__);
+        } else {
+            // Workers only nap, so that they notice new tasks
+            u64 wait_ns = timeout_ms < 0 ? 1000000 : deadline - now;
+            if (fox__current_worker__ != NULL && wait_ns > 1000000)
+                wait_ns = 1000000;
+            struct timespec ts = fox__deadline_after__(wait_ns);
+            cnd_timedwait(&fox__future_cnd__, &fox__future_mtx__, &ts);
+        }
+    }
+    mtx_unlock(&fox__future_mtx__);
+    return satisfied;
+}
+
+bool fox_future_wait_timeout(FoxFuture *future, int timeout_ms) {
+    size_t first;
+    return fox__future_wait__(&future, 1, 1, timeout_ms, &first);
+}
+
+bool fox_future_wait(FoxFuture *future) {
+    fox_future_wait_timeout(future, -1);
+    return fox_future_result(future);
+}
+
+bool fox_future_wait_all(FoxFuture **futures, size_t count, int timeout_ms) {
+    size_t first;
+    return fox__future_wait__(futures, count, count, timeout_ms, &first);
+}
+
+size_t fox_future_wait_any(FoxFuture **futures, size_t count, int timeout_ms) {
+    size_t first = count;
+    if (count > 0)
+        fox__future_wait__(futures, count, 1, timeout_ms, &first);
+    return first;
+}
+
+void fox_future_free(FoxFuture *future) {
+    if (future == NULL)
+        return;
+    fox_future_wait_timeout(future, -1);
+    free(future);
+}
+
+typedef struct {
+    FoxCmd cmd;
+    FoxCmdOpt opt;
+    char *strings;
+} FoxAsyncCmd;
+
+static bool fox__cmd_run_async_fn__(void *arg) {
+    FoxAsyncCmd *async = arg;
+    bool result = fox_cmd_run_opt(&async->cmd, async->opt);
+    free(async->cmd.items);
+    free(async->strings);
+    free(async);
+    return result;
+}
+
+FoxFuture *fox_cmd_run_async_opt(FoxCmd *cmd, FoxCmdOpt opt) {
+    FOX_ASSERT(cmd != NULL, "cmd is NULL");
+    // Plain malloc, the copy is freed on a worker thread which never sees the caller's arena scope
+    FoxAsyncCmd *async = calloc(1, sizeof(FoxAsyncCmd));
+    FOX_ASSERT(async != NULL, "calloc failed");
+    size_t total = 0;
+    for (size_t i = 0; i < cmd->size; i++)
+        total += strlen(cmd->items[i]) + 1;
+    async->strings = malloc(total > 0 ? total : 1);
+    async->cmd.items = malloc((cmd->size > 0 ? cmd->size : 1) * sizeof(const char *));
+    FOX_ASSERT(async->strings != NULL && async->cmd.items != NULL, "malloc failed");
+    char *dst = async->strings;
+    for (size_t i = 0; i < cmd->size; i++) {
+        size_t len = strlen(cmd->items[i]) + 1;
+        memcpy(dst, cmd->items[i], len);
+        async->cmd.items[i] = dst;
+        dst += len;
+    }
+    async->cmd.size = async->cmd.capacity = cmd->size;
+    async->opt = opt;
+    async->opt.reset = false;
+
+    if (opt.reset)
+        fox_da_clear(cmd);
+    return fox_future_async(fox__cmd_run_async_fn__, async);
+}
+
+typedef struct {
+    char *from;
+    char *to;
+    FoxStringBuf *sb;
+    FoxCopyOptions options;
+} FoxAsyncFile;
+
+static bool fox__fs_read_entire_file_async_fn__(void *arg) {
+    FoxAsyncFile *async = arg;
+    bool result = fox_fs_read_entire_file(async->from, async->sb);
+    free(async->from);
+    free(async);
+    return result;
+}
+
+FoxFuture *fox_fs_read_entire_file_async(const char *path, FoxStringBuf *sb) {
+    FoxAsyncFile *async = calloc(1, sizeof(FoxAsyncFile));
+    FOX_ASSERT(async != NULL, "calloc failed");
+    async->from = fox__strdup__(path);
+    async->sb = sb;
+    return fox_future_async(fox__fs_read_entire_file_async_fn__, async);
+}
+
+static bool fox__fs_copy_file_async_fn__(void *arg) {
+    FoxAsyncFile *async = arg;
+    bool result = fox_fs_copy_file(async->from, async->to, async->options);
+    free(async->from);
+    free(async->to);
+    free(async);
+    return result;
+}
+
+FoxFuture *fox_fs_copy_file_async(const char *from, const char *to, FoxCopyOptions options) {
+    FoxAsyncFile *async = calloc(1, sizeof(FoxAsyncFile));
+    FOX_ASSERT(async != NULL, "calloc failed");
+    async->from = fox__strdup__(from);
+    async->to = fox__strdup__(to);
+    async->options = options;
+    return fox_future_async(fox__fs_copy_file_async_fn__, async);
+}
+
+#if !defined(__GNUC__) && !defined(__clang__)
+const void *volatile fox__bench_sink__;
+#endif
+
+typedef struct {
+    const char *name;
+    FoxBenchFn fn;
+    void *user;
+} FoxBenchEntry;
+
+typedef struct {
+    FoxBenchEntry *items;
+    size_t size;
+    size_t capacity;
+} FoxBenchEntries;
+
+static FoxBenchEntries fox__benches__ = {0};
+
+void fox_bench_register(const char *name, FoxBenchFn fn, void *user) {
+    FoxArena *prev_arena = fox_arena_scope_begin(NULL);
+    fox_da_append(&fox__benches__, ((FoxBenchEntry) {.name = name, .fn = fn, .user = user}));
+    fox_arena_scope_end(prev_arena);
+}
+
+static u64 fox__bench_sample__(FoxBenchEntry *entry, size_t iterations, u64 *bytes) {
+    FoxBench bench = {.iterations = iterations, .user = entry->user};
+    u64 start = fox_time_ns();
+    entry->fn(&bench);
+    u64 elapsed = fox_time_ns() - start;
+    *bytes = bench.bytes;
+    return elapsed;
+}
+
+static int fox__bench_cmp_double__(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double fox__bench_median__(const double *sorted, size_t n) { return n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2; }
+
+static FoxBenchResult fox__bench_run__(FoxBenchEntry *entry, FoxBenchOpt opt) {
+    // Double the iterations until one sample is long enough to be measured reliably
+    u64 bytes = 0;
+    size_t iterations = 1;
+    u64 elapsed;
+    while ((elapsed = fox__bench_sample__(entry, iterations, &bytes)) < opt.sample_ns) {
+        if (elapsed * 10 < opt.sample_ns)
+            iterations *= 10;
+        else
+            iterations *= 2;
+    }
+
+    u64 warmup_end = fox_time_ns() + opt.warmup_ns;
+    while (fox_time_ns() < warmup_end)
+        fox__bench_sample__(entry, iterations, &bytes);
+
+    double *times = malloc(opt.samples * sizeof(double));
+    double *deviations = malloc(opt.samples * sizeof(double));
+    FOX_ASSERT(times != NULL && deviations != NULL, "malloc failed");
+    for (size_t i = 0; i < opt.samples; i++)
+        times[i] = (double) fox__bench_sample__(entry, iterations, &bytes) / (double) iterations;
+    qsort(times, opt.samples, sizeof(double), fox__bench_cmp_double__);
+
+    FoxBenchResult result = {.name = entry->name, .iterations = iterations, .samples = opt.samples};
+    result.median_ns = fox__bench_median__(times, opt.samples);
+    result.p99_ns = times[(opt.samples * 99 + 99) / 100 - 1];
+    result.min_ns = times[0];
+    for (size_t i = 0; i < opt.samples; i++)
+        deviations[i] = times[i] > result.median_ns ? times[i] - result.median_ns : result.median_ns - times[i];
+    qsort(deviations, opt.samples, sizeof(double), fox__bench_cmp_double__);
+    result.mad_ns = fox__bench_median__(deviations, opt.samples);
+    if (bytes > 0 && result.median_ns > 0)
+        result.bytes_per_sec = (double) bytes * 1e9 / result.median_ns;
+#ifdef FOX_TRACK_ALLOCS
+    // Counted on one extra sample after the timed ones
+    FoxAllocStats before = fox_alloc_stats();
+    fox__bench_sample__(entry, iterations, &bytes);
+    FoxAllocStats after = fox_alloc_stats();
+    result.allocs = (double) (after.allocs + after.reallocs - before.allocs - before.reallocs) / (double) iterations;
+#endif // FOX_TRACK_ALLOCS
+
+    free(deviations);
+    free(times);
+    return result;
+}
+
+static void fox__bench_print_time__(double ns) {
+    if (ns < 1e3)
+        printf(" %10.2f ns", ns);
+    else if (ns < 1e6)
+        printf(" %10.2f us", ns / 1e3);
+    else if (ns < 1e9)
+        printf(" %10.2f ms", ns / 1e6);
+    else
+        printf(" %10.2f s ", ns / 1e9);
+}
+
+static void fox__bench_json_string__(FoxStringBuf *sb, const char *str) {
+    fox_da_append(sb, '"');
+    for (const char *c = str; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fox_da_append(sb, '\\');
+        if ((unsigned char) *c < 0x20)
+            fox_sb_appendf(sb, "\\u%04x", *c);
+        else
+            fox_da_append(sb, *c);
+    }
+    fox_da_append(sb, '"');
+}
+
+bool fox_bench_run_all_opt(FoxBenchOpt opt) {
+    if (opt.samples == 0)
+        opt.samples = FOX_BENCH_SAMPLES;
+    if (opt.sample_ns == 0)
+        opt.sample_ns = FOX_BENCH_SAMPLE_NS;
+    if (opt.warmup_ns == 0)
+        opt.warmup_ns = FOX_BENCH_WARMUP_NS;
+
+    bool result = true;
+    FoxStringBuf json = {0};
+    fox_sb_concat_cstr(&json, "{\n  \"benchmarks\": [");
+
+    printf("%-40s %13s %13s %13s %14s", "benchmark", "median", "p99", "mad", "throughput");
+#ifdef FOX_TRACK_ALLOCS
+    printf(" %12s", "allocs/iter");
+#endif // FOX_TRACK_ALLOCS
+    printf("\n");
+    size_t ran = 0;
+    fox_da_foreach(FoxBenchEntry, entry, &fox__benches__) {
+        if (opt.filter != NULL && strstr(entry->name, opt.filter) == NULL)
+            continue;
+        FoxBenchResult r = fox__bench_run__(entry, opt);
+
+        printf("%-40s", r.name);
+        fox__bench_print_time__(r.median_ns);
+        fox__bench_print_time__(r.p99_ns);
+        fox__bench_print_time__(r.mad_ns);
+        if (r.bytes_per_sec >= 1024.0 * 1024.0 * 1024.0)
+            printf(" %9.2f GiB/s", r.bytes_per_sec / (1024.0 * 1024.0 * 1024.0));
+        else if (r.bytes_per_sec > 0)
+            printf(" %9.2f MiB/s", r.bytes_per_sec / (1024.0 * 1024.0));
+        else
+            printf(" %14s", "");
+#ifdef FOX_TRACK_ALLOCS
+        printf(" %12.2f", r.allocs);
+#endif // FOX_TRACK_ALLOCS
+        printf("\n");
+        fflush(stdout);
+
+        fox_sb_concat_cstr(&json, ran++ == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ");
+        fox__bench_json_string__(&json, r.name);
+        fox_sb_appendf(&json,
+                       ", \"iterations\": %zu, \"samples\": %zu, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f, "
+                       "\"bytes_per_second\": %.1f",
+                       r.iterations, r.samples, r.median_ns, r.p99_ns, r.mad_ns, r.min_ns, r.bytes_per_sec);
+#ifdef FOX_TRACK_ALLOCS
+        fox_sb_appendf(&json, ", \"allocs_per_iteration\": %.3f", r.allocs);
+#endif // FOX_TRACK_ALLOCS
+        fox_da_append(&json, '}');
+    }
+    fox_sb_concat_cstr(&json, "\n  ]\n}\n");
+
+    if (opt.json_path != NULL && !fox_fs_write_entire_file(opt.json_path, fox_sv(json)))
+        result = false;
+    fox_sb_free(&json);
+    return result;
+}
+
+int fox_bench_main(int argc, char *argv[]) {
+    FoxBenchOpt opt = {0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            opt.json_path = argv[++i];
+        else
+            opt.filter = argv[i];
+    }
+    bool result = fox_bench_run_all_opt(opt);
+    fox_da_free(&fox__benches__);
+    return result ? 0 : 1;
+}
+
+#ifdef FOX_PROFILE
+#    if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#        include <x86intrin.h>
+#        define fox__profile_ticks__() __rdtsc()
+#    else
+#        define fox__profile_ticks__() fox_time_ns()
+#    endif
+
+#    define FOX__PROFILE_BUCKETS__ 32 // Bucket i counts the zones that took [2^i, 2^(i+1)) ticks
+
+typedef struct {
+    u64 calls;
+    u64 total;
+    u64 self;
+    u64 min;
+    u64 max;
+    u32 histogram[FOX__PROFILE_BUCKETS__];
+} FoxZoneStats;
+
+typedef struct FoxProfileThread {
+    FoxZoneStats stats[FOX_PROFILE_MAX_ZONES];
+    u64 child_ticks[FOX_PROFILE_MAX_DEPTH + 1]; // Time spent in the children of each open zone
+    size_t depth;
+    struct FoxProfileThread *next;
+} FoxProfileThread;
+
+static FoxZoneSite *fox__profile_sites__[FOX_PROFILE_MAX_ZONES];
+static atomic_uint fox__profile_site_count__ = 0;
+static FoxProfileThread *fox__profile_threads__ = NULL;
+static FoxZoneStats fox__profile_retired__[FOX_PROFILE_MAX_ZONES]; // The zones of the threads that have exited
+static mtx_t fox__profile_mtx__;
+static once_flag fox__profile_once__ = ONCE_FLAG_INIT;
+static tss_t fox__profile_tss__;
+static thread_local FoxProfileThread *fox__profile_thread__ = NULL;
+static u64 fox__profile_start_ticks__;
+static u64 fox__profile_start_ns__;
+
+static void fox__profile_atexit__(void) { fox_profile_report(stderr); }
+
+static void fox__profile_merge__(FoxZoneStats *to, const FoxZoneStats *from, u32 count) {
+    for (u32 id = 1; id <= count; id++) {
+        if (from[id].calls == 0)
+            continue;
+        if (to[id].calls == 0 || from[id].min < to[id].min)
+            to[id].min = from[id].min;
+        if (from[id].max > to[id].max)
+            to[id].max = from[id].max;
+        to[id].calls += from[id].calls;
+        to[id].total += from[id].total;
+        to[id].self += from[id].self;
+        for (size_t i = 0; i < FOX__PROFILE_BUCKETS__; i++)
+            to[id].histogram[i] += from[id].histogram[i];
+    }
+}
+
+static void fox__profile_thread_exit__(void *data) {
+    FoxProfileThread *thread = data;
+    mtx_lock(&fox__profile_mtx__);
+    fox__profile_merge__(fox__profile_retired__, thread->stats, atomic_load(&fox__profile_site_count__));
+    for (FoxProfileThread **link = &fox__profile_threads__; *link != NULL; link = &(*link)->next) {
+        if (*link == thread) {
+            *link = thread->next;
+            break;
+        }
+    }
+    mtx_unlock(&fox__profile_mtx__);
+    free(thread);
+    // A later destructor may still enter a zone, which starts a new buffer
+    fox__profile_thread__ = NULL;
+}
+
+static void fox__profile_init__(void) {
+    FOX_ASSERT(mtx_init(&fox__profile_mtx__, mtx_plain) == thrd_success, "mtx_init failed");
+    FOX_ASSERT(tss_create(&fox__profile_tss__, fox__profile_thread_exit__) == thrd_success, "tss_create failed");
+    fox__profile_start_ticks__ = fox__profile_ticks__();
+    fox__profile_start_ns__ = fox_time_ns();
+    atexit(fox__profile_atexit__);
+}
+
+static FoxProfileThread *fox__profile_thread_init__(void) {
+    call_once(&fox__profile_once__, fox__profile_init__);
+    FoxProfileThread *thread = calloc(1, sizeof(FoxProfileThread));
+    FOX_ASSERT(thread != NULL, "calloc failed");
+    mtx_lock(&fox__profile_mtx__);
+    thread->next = fox__profile_threads__;
+    fox__profile_threads__ = thread;
+    mtx_unlock(&fox__profile_mtx__);
+    // The destructor runs when the thread exits, the main thread keeps its buffer until the report at exit
+    FOX_ASSERT(tss_set(fox__profile_tss__, thread) == thrd_success, "tss_set failed");
+    fox__profile_thread__ = thread;
+    return thread;
+}
+
+static u32 fox__profile_site_id__(FoxZoneSite *site) {
+    u32 id = atomic_load_explicit(&site->id, memory_order_acquire);
+    if (id != 0)
+        return id;
+
+    mtx_lock(&fox__profile_mtx__);
+    id = atomic_load_explicit(&site->id, memory_order_relaxed);
+    if (id == 0) {
+        id = atomic_load(&fox__profile_site_count__) + 1;
+        FOX_ASSERT(id < FOX_PROFILE_MAX_ZONES, "too many zones, increase FOX_PROFILE_MAX_ZONES");
+        fox__profile_sites__[id] = site;
+        atomic_store(&fox__profile_site_count__, id);
+        atomic_store_explicit(&site->id, id, memory_order_release);
+    }
+    mtx_unlock(&fox__profile_mtx__);
+    return id;
+}
+
+FoxZone fox__zone_begin__(FoxZoneSite *site) {
+    FoxProfileThread *thread = fox__profile_thread__ != NULL ? fox__profile_thread__ : fox__profile_thread_init__();
+    u32 id = fox__profile_site_id__(site);
+    if (thread->depth < FOX_PROFILE_MAX_DEPTH)
+        thread->child_ticks[thread->depth + 1] = 0;
+    thread->depth++;
+    return (FoxZone) {.start = fox__profile_ticks__(), .id = id};
+}
+
+void fox__zone_end__(FoxZone *zone) {
+    u64 elapsed = fox__profile_ticks__() - zone->start;
+    FoxProfileThread *thread = fox__profile_thread__;
+    size_t depth = thread->depth--;
+    u64 children = depth <= FOX_PROFILE_MAX_DEPTH ? thread->child_ticks[depth] : 0;
+    if (depth - 1 <= FOX_PROFILE_MAX_DEPTH)
+        thread->child_ticks[depth - 1] += elapsed;
+
+    FoxZoneStats *stats = &thread->stats[zone->id];
+    if (stats->calls == 0 || elapsed < stats->min)
+        stats->min = elapsed;
+    if (elapsed > stats->max)
+        stats->max = elapsed;
+    stats->calls++;
+    stats->total += elapsed;
+    stats->self += elapsed > children ? elapsed - children : 0;
+    u32 bucket = 0;
+    while (bucket + 1 < FOX__PROFILE_BUCKETS__ && (elapsed >> (bucket + 1)) != 0)
+        bucket++;
+    stats->histogram[bucket]++;
+}
+
+void fox_profile_report(FILE *out) {
+    u32 count = atomic_load(&fox__profile_site_count__);
+    if (count == 0)
+        return;
+
+    // Ticks are converted with the rate measured since the first zone
+    double ns_per_tick = 1.0;
+    u64 ticks = fox__profile_ticks__() - fox__profile_start_ticks__;
+    if (ticks > 0)
+        ns_per_tick = (double) (fox_time_ns() - fox__profile_start_ns__) / (double) ticks;
+
+    FoxZoneStats *merged = calloc(count + 1, sizeof(FoxZoneStats));
+    FOX_ASSERT(merged != NULL, "calloc failed");
+    mtx_lock(&fox__profile_mtx__);
+    fox__profile_merge__(merged, fox__profile_retired__, count);
+    for (FoxProfileThread *thread = fox__profile_threads__; thread != NULL; thread = thread->next)
+        fox__profile_merge__(merged, thread->stats, count);
+    mtx_unlock(&fox__profile_mtx__);
+
+    // Sort the zone ids by self time, there are only a few hundred at most
+    u32 order[FOX_PROFILE_MAX_ZONES];
+    for (u32 i = 0; i < count; i++) {
+        u32 j = i;
+        for (; j > 0 && merged[order[j - 1]].self < merged[i + 1].self; j--)
+            order[j] = order[j - 1];
+        order[j] = i + 1;
+    }
+
+    fprintf(out, "%-32s %-28s %10s %12s %12s %10s %10s %10s\n", "zone", "location", "calls", "total ms", "self ms", "avg ns", "min ns", "max ns");
+    for (u32 i = 0; i < count; i++) {
+        FoxZoneStats *stats = &merged[order[i]];
+        if (stats->calls == 0)
+            continue;
+        FoxZoneSite *site = fox__profile_sites__[order[i]];
+        const char *file = strrchr(site->file, '/') != NULL ? strrchr(site->file, '/') + 1 : site->file;
+
+        char location[64];
+        snprintf(location, sizeof(location), "%s:%u", file, site->line);
+        fprintf(out, "%-32s %-28s %10llu %12.3f %12.3f %10.0f %10.0f %10.0f\n", site->name, location, (unsigned long long) stats->calls,
+                (double) stats->total * ns_per_tick / 1e6, (double) stats->self * ns_per_tick / 1e6,
+                (double) stats->total * ns_per_tick / (double) stats->calls, (double) stats->min * ns_per_tick, (double) stats->max * ns_per_tick);
+
+        fprintf(out, "%-32s", "");
+        for (size_t b = 0; b < FOX__PROFILE_BUCKETS__; b++) {
+            if (stats->histogram[b] == 0)
+                continue;
+            double low = (double) (1ull << b) * ns_per_tick;
+            if (low < 1e3)
+                fprintf(out, " %.0fns:%u", low, stats->histogram[b]);
+            else if (low < 1e6)
+                fprintf(out, " %.0fus:%u", low / 1e3, stats->histogram[b]);
+            else
+                fprintf(out, " %.0fms:%u", low / 1e6, stats->histogram[b]);
+        }
+        fprintf(out, "\n");
+    }
+    free(merged);
+}
+
+void fox_profile_reset(void) {
+    if (atomic_load(&fox__profile_site_count__) == 0)
+        return;
+    mtx_lock(&fox__profile_mtx__);
+    memset(fox__profile_retired__, 0, sizeof(fox__profile_retired__));
+    for (FoxProfileThread *thread = fox__profile_threads__; thread != NULL; thread = thread->next)
+        memset(thread->stats, 0, sizeof(thread->stats));
+    mtx_unlock(&fox__profile_mtx__);
+}
+#endif // FOX_PROFILE
+
+#ifdef FOX_TRACK_ALLOCS
+typedef struct {
+    const char *file;
+    int line;
+    FoxAllocStats stats;
+} FoxAllocSite;
+
+typedef struct {
+    void *ptr; // NULL marks an empty slot
+    size_t size;
+    u32 site;
+} FoxAllocBlock;
+
+// Both tables use plain malloc, so that tracking never tracks itself
+static struct {
+    mtx_t mtx;
+    FoxAllocSite *sites;
+    size_t site_count;
+    size_t site_capacity; // Power of two, the sites are found through site_index
+    u32 *site_index;      // Open addressing, stores index + 1
+    FoxAllocBlock *blocks;
+    size_t block_count;
+    size_t block_capacity; // Power of two
+    FoxAllocStats total;
+} fox__allocs__;
+static once_flag fox__allocs_once__ = ONCE_FLAG_INIT;
+
+static void fox__allocs_atexit__(void) { fox_alloc_report(stderr); }
+
+static void fox__allocs_init__(void) {
+    FOX_ASSERT(mtx_init(&fox__allocs__.mtx, mtx_plain) == thrd_success, "mtx_init failed");
+    atexit(fox__allocs_atexit__);
+}
+
+static size_t fox__ptr_hash__(const void *p) {
+    u64 x = (u64) (uintptr_t) p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+static u32 fox__alloc_site__(const char *file, int line) {
+    if (fox__allocs__.site_count * 2 >= fox__allocs__.site_capacity) {
+        size_t cap = fox__allocs__.site_capacity == 0 ? 64 : fox__allocs__.site_capacity * 2;
+        FoxAllocSite *sites = realloc(fox__allocs__.sites, cap * sizeof(FoxAllocSite));
+        u32 *index = calloc(cap, sizeof(u32));
+        FOX_ASSERT(sites != NULL && index != NULL, "could not grow the allocation sites");
+        for (size_t i = 0; i < fox__allocs__.site_count; i++) {
+            size_t slot = (fox__ptr_hash__(sites[i].file) ^ (size_t) sites[i].line) & (cap - 1);
+            while (index[slot] != 0)
+                slot = (slot + 1) & (cap - 1);
+            index[slot] = (u32) i + 1;
+        }
+        free(fox__allocs__.site_index);
+        fox__allocs__.sites = sites;
+        fox__allocs__.site_index = index;
+        fox__allocs__.site_capacity = cap;
+    }
+
+    size_t mask = fox__allocs__.site_capacity - 1;
+    size_t slot = (fox__ptr_hash__(file) ^ (size_t) line) & mask;
+    for (; fox__allocs__.site_index[slot] != 0; slot = (slot + 1) & mask) {
+        FoxAllocSite *site = &fox__allocs__.sites[fox__allocs__.site_index[slot] - 1];
+        if (site->file == file && site->line == line)
+            return fox__allocs__.site_index[slot] - 1;
+    }
+    u32 id = (u32) fox__allocs__.site_count++;
+    fox__allocs__.sites[id] = (FoxAllocSite) {.file = file, .line = line};
+    fox__allocs__.site_index[slot] = id + 1;
+    return id;
+}
+
+static FoxAllocBlock *fox__alloc_block_find__(const void *p) {
+    if (fox__allocs__.block_capacity == 0)
+        return NULL;
+    size_t mask = fox__allocs__.block_capacity - 1;
+    for (size_t slot = fox__ptr_hash__(p) & mask; fox__allocs__.blocks[slot].ptr != NULL; slot = (slot + 1) & mask) {
+        if (fox__allocs__.blocks[slot].ptr == p)
+            return &fox__allocs__.blocks[slot];
+    }
+    return NULL;
+}
+
+static void fox__alloc_block_insert__(FoxAllocBlock block) {
+    if ((fox__allocs__.block_count + 1) * 4 >= fox__allocs__.block_capacity * 3) {
+        size_t old_cap = fox__allocs__.block_capacity;
+        FoxAllocBlock *old = fox__allocs__.blocks;
+        fox__allocs__.block_capacity = old_cap == 0 ? 1024 : old_cap * 2;
+        fox__allocs__.blocks = calloc(fox__allocs__.block_capacity, sizeof(FoxAllocBlock));
+        FOX_ASSERT(fox__allocs__.blocks != NULL, "could not grow the allocation table");
+        fox__allocs__.block_count = 0;
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].ptr != NULL)
+                fox__alloc_block_insert__(old[i]);
+        free(old);
+    }
+    size_t mask = fox__allocs__.block_capacity - 1;
+    size_t slot = fox__ptr_hash__(block.ptr) & mask;
+    while (fox__allocs__.blocks[slot].ptr != NULL)
+        slot = (slot + 1) & mask;
+    fox__allocs__.blocks[slot] = block;
+    fox__allocs__.block_count++;
+}
+
+// Backward shift deletion, so that lookups never need tombstones
+static void fox__alloc_block_remove__(FoxAllocBlock *block) {
+    size_t mask = fox__allocs__.block_capacity - 1;
+    size_t hole = (size_t) (block - fox__allocs__.blocks);
+    for (size_t slot = (hole + 1) & mask; fox__allocs__.blocks[slot].ptr != NULL; slot = (slot + 1) & mask) {
+        size_t home = fox__ptr_hash__(fox__allocs__.blocks[slot].ptr) & mask;
+        // Move the entry into the hole unless its home lies cyclically in (hole, slot]
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            fox__allocs__.blocks[hole] = fox__allocs__.blocks[slot];
+            hole = slot;
+        }
+    }
+    fox__allocs__.blocks[hole].ptr = NULL;
+    fox__allocs__.block_count--;
+}
+
+static void fox__alloc_stats_add__(FoxAllocStats *stats, size_t old_size, size_t new_size, bool is_new) {
+    if (new_size == 0) {
+        stats->frees++;
+        stats->live_blocks--;
+    } else if (is_new) {
+        stats->allocs++;
+        stats->live_blocks++;
+        stats->bytes += new_size;
+    } else if (new_size > old_size) {
+        stats->reallocs++;
+        stats->bytes += new_size;
+    }
+    stats->live_bytes = stats->live_bytes + new_size - old_size;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+}
+
+void *fox__track_realloc__(void *p, size_t size, const char *file, int line) {
+    FOX_ASSERT(fox_realloc != NULL, "fox_realloc cannot be NULL");
+    FoxArena *arena = fox__arena_scope__;
+    if (arena != NULL && (p == NULL || fox__arena_owns__(arena, p)))
+        return fox_realloc(p, size);
+
+    void *result = fox_realloc(p, size);
+    if (p == NULL && result == NULL)
+        return NULL;
+    if (size > 0 && result == NULL)
+        return NULL; // The old block is untouched
+
+    call_once(&fox__allocs_once__, fox__allocs_init__);
+    mtx_lock(&fox__allocs__.mtx);
+    size_t old_size = 0;
+    u32 site = 0;
+    bool is_new = true;
+    FoxAllocBlock *block = p != NULL ? fox__alloc_block_find__(p) : NULL;
+    if (block == NULL && fox__allocs_paused__ > 0) {
+        mtx_unlock(&fox__allocs__.mtx);
+        return result;
+    }
+    if (block != NULL) {
+        // A block keeps the site that allocated it, growth is counted there too
+        old_size = block->size;
+        site = block->site;
+        is_new = false;
+        fox__alloc_block_remove__(block);
+    } else if (p != NULL) {
+        // Allocated before tracking saw it (e.g. by a custom fox_realloc), count it as new
+        site = fox__alloc_site__(file, line);
+        if (size == 0) {
+            mtx_unlock(&fox__allocs__.mtx);
+            return result;
+        }
+    } else {
+        site = fox__alloc_site__(file, line);
+    }
+    if (size > 0)
+        fox__alloc_block_insert__((FoxAllocBlock) {.ptr = result, .size = size, .site = site});
+
+    fox__alloc_stats_add__(&fox__allocs__.sites[site].stats, old_size, size, is_new);
+    fox__alloc_stats_add__(&fox__allocs__.total, old_size, size, is_new);
+    mtx_unlock(&fox__allocs__.mtx);
+    return result;
+}
+
+FoxAllocStats fox_alloc_stats(void) {
+    call_once(&fox__allocs_once__, fox__allocs_init__);
+    mtx_lock(&fox__allocs__.mtx);
+    FoxAllocStats total = fox__allocs__.total;
+    mtx_unlock(&fox__allocs__.mtx);
+    return total;
+}
+
+#    ifndef FOX_ALLOC_REPORT_SITES
+#        define FOX_ALLOC_REPORT_SITES 20 // Number of call sites in the report
+#    endif // FOX_ALLOC_REPORT_SITES
+
+void fox_alloc_report(FILE *out) {
+    call_once(&fox__allocs_once__, fox__allocs_init__);
+    mtx_lock(&fox__allocs__.mtx);
+    if (fox__allocs__.site_count == 0) {
+        mtx_unlock(&fox__allocs__.mtx);
+        return;
+    }
+
+    // Selection of the busiest sites, a full sort is not needed for a short report
+    size_t count = fox__allocs__.site_count;
+    u32 *order = malloc(count * sizeof(u32));
+    FOX_ASSERT(order != NULL, "malloc failed");
+    for (size_t i = 0; i < count; i++)
+        order[i] = (u32) i;
+    size_t shown = count < FOX_ALLOC_REPORT_SITES ? count : FOX_ALLOC_REPORT_SITES;
+    for (size_t i = 0; i < shown; i++) {
+        size_t best = i;
+        for (size_t j = i + 1; j < count; j++) {
+            FoxAllocStats *a = &fox__allocs__.sites[order[j]].stats, *b = &fox__allocs__.sites[order[best]].stats;
+            if (a->allocs + a->reallocs > b->allocs + b->reallocs)
+                best = j;
+        }
+        u32 tmp = order[i];
+        order[i] = order[best];
+        order[best] = tmp;
+    }
+
+    FoxAllocStats *total = &fox__allocs__.total;
+    fprintf(out, "allocations: %zu allocs, %zu reallocs, %zu frees, %zu bytes requested, %zu bytes peak\n", total->allocs, total->reallocs,
+            total->frees, total->bytes, total->peak_bytes);
+    fprintf(out, "%-40s %10s %10s %10s %14s %14s %14s\n", "site", "allocs", "reallocs", "frees", "bytes", "live", "peak");
+    for (size_t i = 0; i < shown; i++) {
+        FoxAllocSite *site = &fox__allocs__.sites[order[i]];
+        const char *file = strrchr(site->file, '/') != NULL ? strrchr(site->file, '/') + 1 : site->file;
+        char location[64];
+        snprintf(location, sizeof(location), "%s:%d", file, site->line);
+        fprintf(out, "%-40s %10zu %10zu %10zu %14zu %14zu %14zu\n", location, site->stats.allocs, site->stats.reallocs, site->stats.frees,
+                site->stats.bytes, site->stats.live_bytes, site->stats.peak_bytes);
+    }
+
+    if (total->live_blocks > 0) {
+        fprintf(out, "leaks: %zu bytes in %zu blocks\n", total->live_bytes, total->live_blocks);
+        for (size_t i = 0; i < count; i++) {
+            FoxAllocSite *site = &fox__allocs__.sites[i];
+            if (site->stats.live_blocks > 0)
+                fprintf(out, "    %s:%d: %zu bytes in %zu blocks\n", site->file, site->line, site->stats.live_bytes, site->stats.live_blocks);
+        }
+    }
+    free(order);
+    mtx_unlock(&fox__allocs__.mtx);
+}
+#endif // FOX_TRACK_ALLOCS
+
 #endif // FOX_IMPLEMENTATION